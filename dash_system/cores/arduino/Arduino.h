@@ -83,7 +83,9 @@ void __cxa_pure_virtual();
 //#include "Serial.h"
 #include "Spi.h"
 #include "MCUFlash.h"
+#include "CRC32.h"
 #include "FlashStore.h"
+#include "FlashQueue.h"
 #include "Updater.h"
 #endif // __cplusplus
 
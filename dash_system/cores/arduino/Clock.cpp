@@ -140,11 +140,39 @@ int8_t ClockClass::adjusted()
     return (int8_t)RTC_HAL_GetTimeCompensationRegister(RTC);
 }
 
+//trims the oscillator for error seconds lost (+) or gained (-) over elapsed
+//seconds, each compensation tick is one 32.768kHz cycle per interval
+void ClockClass::trim(int32_t error, uint32_t elapsed)
+{
+    if(elapsed == 0) return;
+    uint32_t interval = RTC_HAL_GetCompensationIntervalRegister(RTC) + 1;
+    int32_t ticks = (int32_t)((int64_t)error * 32768 * interval / elapsed);
+    int32_t value = adjusted() + ticks;
+    if(value > 127) value = 127;
+    if(value < -128) value = -128;
+    adjust((int8_t)value);
+}
+
 uint32_t ClockClass::counter()
 {
     return RTC_HAL_GetSecsReg(RTC);
 }
 
+//the alarm register holds an absolute time, an alarm that is set moves with
+//the counter so it still goes off as many seconds from now
+void ClockClass::setCounter(uint32_t seconds)
+{
+    if(alarm_expired) {
+        RTC_HAL_SetDatetimeInsecs(RTC, seconds);
+        return;
+    }
+    RTC_HAL_SetAlarmIntCmd(RTC, false);
+    uint32_t delta = seconds - counter();
+    RTC_HAL_SetDatetimeInsecs(RTC, seconds);
+    RTC_HAL_SetAlarmReg(RTC, RTC_HAL_GetAlarmReg(RTC) + delta);
+    RTC_HAL_SetAlarmIntCmd(RTC, true);
+}
+
 void ClockClass::enableSeconds(bool enable) {
     seconds_enabled = enable;
     RTC_HAL_SetSecsIntCmd(RTC, seconds_enabled);
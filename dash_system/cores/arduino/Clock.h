@@ -59,9 +59,11 @@ public:
     bool alarmExpired();
 
     uint32_t counter();
+    void setCounter(uint32_t seconds);
 
     void adjust(int8_t ticks);
     int8_t adjusted();
+    void trim(int32_t error, uint32_t elapsed);
 
     void alarmInterrupt();
     void secondsInterrupt();
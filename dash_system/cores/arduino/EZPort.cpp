@@ -57,3 +57,21 @@ void EZPort::end()
     pinMode(ssPin, DISABLE);
     pinMode(resetPin, DISABLE);
 }
+
+//fast read, a dummy byte follows the address and the clock may run at full
+//speed rather than the half system clock that plain reads are limited to
+void EZPort::read(uint32_t address, uint8_t *buffer, size_t count)
+{
+    beginRead(address);
+    if(!ready()) return;
+    spi->read(buffer, count);
+    endRead();
+}
+
+void EZPort::beginRead(uint32_t address)
+{
+    if(!ready()) return;
+    digitalWrite(ssPin, LOW);
+    sendAddress(0x0B, address);
+    spi->transfer(0x00);
+}
@@ -30,6 +30,8 @@ public:
     void begin();
     void end();
     uint8_t eraseSector(uint32_t address) {return command(address, 0xD8);}
+    void read(uint32_t address, uint8_t *buffer, size_t count);
+    void beginRead(uint32_t address);
 
 protected:
     uint32_t resetPin;
@@ -36,46 +36,53 @@ String Flash::readString(uint32_t address, size_t count)
     if(!ready()) return String("");
     String str;
     str.reserve(count);
-    beginRead(address);
-    for(int i=0; i<count; i++)
-        str += (char)continueRead();
-    endRead();
+    char block[FLASH_BLOCK_SIZE];
+    while(count)
+    {
+        size_t chunk = count < FLASH_BLOCK_SIZE ? count : FLASH_BLOCK_SIZE;
+        read(address, (uint8_t*)block, chunk);
+        //exactly chunk bytes, a zero byte must not cut the block short
+        for(size_t i=0; i<chunk; i++)
+            str += block[i];
+        address += chunk;
+        count -= chunk;
+    }
     return str;
 }
 
 bool Flash::compareString(uint32_t address, const String &str)
 {
     if(!ready()) return false;
-    bool match = true;
-    beginRead(address);
-    for(int i=0; i<str.length(); i++)
+    uint8_t block[FLASH_BLOCK_SIZE];
+    const char *cstr = str.c_str();
+    size_t count = str.length();
+    while(count)
     {
-        char c = (char)continueRead();
-        if(c != str[i])
-        {
-            match = false;
-            break;
-        }
+        size_t chunk = count < FLASH_BLOCK_SIZE ? count : FLASH_BLOCK_SIZE;
+        read(address, block, chunk);
+        if(memcmp(block, cstr, chunk) != 0)
+            return false;
+        address += chunk;
+        cstr += chunk;
+        count -= chunk;
     }
-    endRead();
-    return match;
+    return true;
 }
 
 bool Flash::isSectorErased(uint32_t address)
 {
-    bool erased = true;
+    uint32_t block[FLASH_BLOCK_SIZE/4];
     address &= ~(sectorSize-1);
-    beginRead(address);
-    for(int i=0; i<sectorSize; i++)
+    for(uint32_t offset=0; offset<sectorSize; offset+=FLASH_BLOCK_SIZE)
     {
-        if(continueRead() != 0xFF)
+        read(address+offset, (uint8_t*)block, FLASH_BLOCK_SIZE);
+        for(int i=0; i<FLASH_BLOCK_SIZE/4; i++)
         {
-            erased = false;
-            break;
+            if(block[i] != 0xFFFFFFFF)
+                return false;
         }
     }
-    endRead();
-    return erased;
+    return true;
 }
 
 bool Flash::copyFrom(Stream &stream, uint32_t dst, uint32_t count)
@@ -87,16 +94,17 @@ bool Flash::copyFrom(Stream &stream, uint32_t dst, uint32_t count)
 
     uint32_t last = dst+count;
     uint32_t sectormask = (size-1);
-    uint32_t writesize = getMaxWrite();
+    uint32_t writesize = blockSize();
+    uint8_t block[FLASH_BLOCK_SIZE];
     while(dst < last)
     {
         if((dst & sectormask) == 0)
             eraseSector(dst);
 
-        beginWrite(dst);
-        for(int i=0; i<writesize; i++)
-            continueWrite(stream.read());
-        endWrite();
+        //a short read leaves the rest of the block erased
+        size_t got = stream.readBytes(block, writesize);
+        memset(&block[got], 0xFF, writesize-got);
+        programPage(dst, block, writesize);
 
         dst += writesize;
     }
@@ -119,10 +127,7 @@ bool Flash::copyFrom(uint32_t dst, uint32_t src, uint32_t count)
         if((dst & sectormask) == 0)
             eraseSector(dst);
 
-        beginWrite(dst);
-        for(int i=0; i<writesize; i++)
-            continueWrite(srcbuff[i]);
-        endWrite();
+        programPage(dst, srcbuff, writesize);
 
         dst += writesize;
         srcbuff += writesize;
@@ -140,18 +145,15 @@ bool Flash::copyFrom(Flash &flash, uint32_t dst, uint32_t src, uint32_t count)
 
     uint32_t last = dst+count;
     uint32_t sectormask = (size-1);
-    uint32_t writesize = getMaxWrite();
+    uint32_t writesize = blockSize();
+    uint8_t block[FLASH_BLOCK_SIZE];
     while(dst < last)
     {
         if((dst & sectormask) == 0)
             eraseSector(dst);
 
-        beginWrite(dst);
-        flash.beginRead(src);
-        for(int i=0; i<writesize; i++)
-            continueWrite(flash.continueRead());
-        flash.endRead();
-        endWrite();
+        flash.read(src, block, writesize);
+        programPage(dst, block, writesize);
 
         dst += writesize;
         src += writesize;
@@ -25,6 +25,11 @@
 #include "WString.h"
 #include "Stream.h"
 
+//stack buffer for block reads and flash to flash copies
+#ifndef FLASH_BLOCK_SIZE
+#define FLASH_BLOCK_SIZE 64
+#endif
+
 class Flash {
 protected:
     uint32_t sectorSize;
@@ -36,6 +41,7 @@ public:
 
     uint32_t getSectorSize()    {return sectorSize;}
     uint32_t getMaxWrite()      {return maxWrite;}
+    uint32_t blockSize()        {return maxWrite < FLASH_BLOCK_SIZE ? maxWrite : FLASH_BLOCK_SIZE;}
 
     virtual bool ready()        {return begun;}
     virtual void begin()        {begun = true;}
@@ -56,8 +62,12 @@ public:
 
     bool isSectorErased(uint32_t address);
 
+    //block reads run in a single transaction, the byte at a time calls below
+    //are for callers that produce or consume data as they go
     virtual void read(uint32_t address, uint8_t *buffer, size_t count) = 0;
     virtual uint8_t write(uint32_t address, uint8_t *buffer, size_t count) = 0;
+    //one program operation, the range must not cross a maxWrite boundary
+    virtual uint8_t programPage(uint32_t address, uint8_t *buffer, size_t count) = 0;
     virtual uint8_t eraseSector(uint32_t address) = 0;
     virtual uint8_t eraseAll() = 0;
 
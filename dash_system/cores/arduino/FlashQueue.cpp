@@ -0,0 +1,314 @@
+/*
+  FlashQueue.cpp - Class definitions that provide a persistent first in,
+  first out record queue in a Flash memory
+
+  https://hologram.io
+
+  Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "FlashQueue.h"
+
+#define QUEUE_ID        (0x51A0A051)
+#define RECORD_MAGIC    (0x5152)
+
+FlashQueue::FlashQueue(Flash &flash)
+: flash(&flash), start_address(0xFFFFFFFF), num_sectors(0), used_sectors(0),
+head(0), tail(0), next_seq(0), free_address(0), num_records(0), loaded(false) {}
+
+void FlashQueue::begin(uint32_t sector, uint32_t sectors)
+{
+    if(!flash->ready())
+        flash->begin();
+    start_address = sector*(flash->getSectorSize());
+    num_sectors = sectors;
+}
+
+void FlashQueue::end()
+{
+    loaded = false;
+}
+
+//delete every record
+void FlashQueue::create()
+{
+    for(uint32_t i=0; i<num_sectors; i++)
+    {
+        flash->eraseSector(sectorAddress(i));
+    }
+    used_sectors = 0;
+    head = 0;
+    tail = 0;
+    next_seq = 0;
+    free_address = 0;
+    num_records = 0;
+    loaded = num_sectors >= 2;
+}
+
+uint32_t FlashQueue::storedLength(uint32_t len)
+{
+    if((len % 4) == 0) return len;
+    return len+(4-len%4);
+}
+
+uint32_t FlashQueue::maxLength()
+{
+    uint32_t max = sectorSize() - sizeof(sector_header_t) - sizeof(record_t);
+    return max < 0xFFFF ? max : 0xFFFE;
+}
+
+uint32_t FlashQueue::available()
+{
+    if(!loaded) return 0;
+    uint32_t space = (num_sectors - used_sectors) * (sectorSize() - sizeof(sector_header_t));
+    if(used_sectors)
+        space += sectorAddress(tail) + sectorSize() - free_address;
+    return space;
+}
+
+bool FlashQueue::load()
+{
+    loaded = false;
+    if(num_sectors < 2) return false;
+
+    sector_header_t header;
+    uint32_t first_seq = 0;
+    used_sectors = 0;
+    num_records = 0;
+    head = 0;
+    tail = 0;
+    free_address = 0;
+
+    //anything without the queue id is free, openSector erases it before use
+    for(uint32_t i=0; i<num_sectors; i++)
+    {
+        flash->read(sectorAddress(i), (uint8_t*)&header, sizeof(header));
+        if(header.id != QUEUE_ID)
+            continue;
+        if(used_sectors == 0 || header.seq < first_seq)
+        {
+            first_seq = header.seq;
+            head = i;
+        }
+        used_sectors++;
+    }
+
+    //sectors in use must follow on from the head in sequence
+    uint32_t sector = head;
+    for(uint32_t i=0; i<used_sectors; i++, sector = nextSector(sector))
+    {
+        flash->read(sectorAddress(sector), (uint8_t*)&header, sizeof(header));
+        if(header.id != QUEUE_ID || header.seq != first_seq + i)
+            return false;
+        num_records += scanSector(sector, &free_address);
+        tail = sector;
+    }
+    next_seq = first_seq + used_sectors;
+
+    loaded = true;
+    reclaim();
+    return true;
+}
+
+//counts the pending records in a sector and drops any that fail their crc,
+//end is set past the last record
+uint32_t FlashQueue::scanSector(uint32_t sector, uint32_t *end)
+{
+    record_t record;
+    uint32_t pending = 0;
+    uint32_t limit = sectorAddress(sector) + sectorSize();
+    uint32_t address = sectorAddress(sector) + sizeof(sector_header_t);
+
+    while(address + sizeof(record) <= limit)
+    {
+        flash->read(address, (uint8_t*)&record, sizeof(record));
+        if(record.magic == 0xFFFF)
+            break; //no more records
+        if(record.magic != RECORD_MAGIC || address + recordLength(record.length) > limit)
+        {
+            //unreadable header, nothing more can be appended here
+            address = limit;
+            break;
+        }
+        if(record.pending)
+        {
+            if(checkRecord(address, &record))
+                pending++;
+            else
+            {
+                uint32_t cleared = 0x00;
+                flash->write(address+8, (uint8_t*)&cleared, 4);
+            }
+        }
+        address += recordLength(record.length);
+    }
+    if(end) *end = address;
+    return pending;
+}
+
+bool FlashQueue::checkRecord(uint32_t address, const record_t *record)
+{
+    uint8_t buffer[32];
+    uint32_t crc = 0;
+    uint32_t left = record->length;
+    address += sizeof(record_t);
+    while(left)
+    {
+        uint32_t read_size = left;
+        if(read_size > 32) read_size = 32;
+        flash->read(address, buffer, read_size);
+        crc = crc32(crc, buffer, read_size);
+        address += read_size;
+        left -= read_size;
+    }
+    return crc == record->crc;
+}
+
+bool FlashQueue::findRecord(uint32_t index, uint32_t *address, record_t *record)
+{
+    if(!loaded || index >= num_records) return false;
+
+    uint32_t sector = head;
+    for(uint32_t i=0; i<used_sectors; i++, sector = nextSector(sector))
+    {
+        uint32_t limit = sectorAddress(sector) + sectorSize();
+        *address = sectorAddress(sector) + sizeof(sector_header_t);
+        while(*address + sizeof(record_t) <= limit)
+        {
+            flash->read(*address, (uint8_t*)record, sizeof(record_t));
+            if(record->magic != RECORD_MAGIC || *address + recordLength(record->length) > limit)
+                break;
+            if(record->pending)
+            {
+                if(index == 0)
+                    return true;
+                index--;
+            }
+            *address += recordLength(record->length);
+        }
+    }
+    return false;
+}
+
+//starts a new tail sector, the sequence is written before the id so an
+//interrupted header never looks valid
+bool FlashQueue::openSector(uint32_t sector)
+{
+    uint32_t address = sectorAddress(sector);
+    if(!flash->isSectorErased(address))
+        flash->eraseSector(address);
+
+    sector_header_t header = {QUEUE_ID, next_seq++};
+    flash->write(address+4, (uint8_t*)&header.seq, 4);
+    flash->write(address, (uint8_t*)&header.id, 4);
+
+    if(used_sectors == 0)
+        head = sector;
+    tail = sector;
+    used_sectors++;
+    free_address = address + sizeof(header);
+    return true;
+}
+
+//erases sectors at the head once every record in them has been popped
+void FlashQueue::reclaim()
+{
+    while(used_sectors > 1 && scanSector(head, NULL) == 0)
+    {
+        flash->eraseSector(sectorAddress(head));
+        head = nextSector(head);
+        used_sectors--;
+    }
+}
+
+//flash is programmed in whole words, the last one is padded with 0xFF
+void FlashQueue::writePadded(uint32_t address, const uint8_t *content, uint32_t length)
+{
+    uint32_t aligned = length & ~3;
+    if(aligned)
+        flash->write(address, (uint8_t*)content, aligned);
+    if(aligned < length)
+    {
+        uint8_t last[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+        memcpy(last, &content[aligned], length-aligned);
+        flash->write(address+aligned, last, 4);
+    }
+}
+
+bool FlashQueue::push(const uint8_t *content, uint32_t length)
+{
+    if(!loaded) return false;
+    if(length == 0 || length > maxLength()) return false;
+
+    if(used_sectors == 0)
+    {
+        openSector(head);
+    }
+    else if(free_address + recordLength(length) > sectorAddress(tail) + sectorSize())
+    {
+        if(used_sectors == num_sectors)
+            reclaim();
+        if(used_sectors == num_sectors)
+            return false; //full
+        openSector(nextSector(tail));
+    }
+
+    //the crc goes in last, a record cut short by a reset fails its check
+    record_t record = {RECORD_MAGIC, (uint16_t)length};
+    record.crc = crc32(0, content, length);
+    flash->write(free_address, (uint8_t*)&record, 4);
+    writePadded(free_address+sizeof(record), content, length);
+    flash->write(free_address+4, (uint8_t*)&record.crc, 4);
+
+    free_address += recordLength(length);
+    num_records++;
+    return true;
+}
+
+//reads the index'th pending record, returns its length or -1
+int FlashQueue::peek(uint32_t index, uint8_t *buffer, uint32_t size)
+{
+    uint32_t address;
+    record_t record;
+    if(!findRecord(index, &address, &record))
+        return -1;
+    if(record.length > size)
+        return -1;
+    flash->read(address+sizeof(record), buffer, record.length);
+    if(crc32(0, buffer, record.length) != record.crc)
+        return -1;
+    return record.length;
+}
+
+//marks the oldest records popped, returns the number removed
+uint32_t FlashQueue::pop(uint32_t count)
+{
+    uint32_t popped = 0;
+    while(popped < count)
+    {
+        uint32_t address;
+        record_t record;
+        if(!findRecord(0, &address, &record))
+            break;
+        uint32_t cleared = 0x00;
+        flash->write(address+8, (uint8_t*)&cleared, 4);
+        num_records--;
+        popped++;
+    }
+    if(popped)
+        reclaim();
+    return popped;
+}
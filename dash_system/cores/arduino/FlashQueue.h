@@ -0,0 +1,86 @@
+/*
+  FlashQueue.h - Class definitions that provide a persistent first in,
+  first out record queue in a Flash memory
+
+  https://hologram.io
+
+  Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+#include "Flash.h"
+#include "CRC32.h"
+
+//Records are appended to a ring of sectors and never span one. A popped
+//record is only marked, its sector is erased once none are left pending.
+class FlashQueue
+{
+public:
+    FlashQueue(Flash &flash);
+    void begin(uint32_t sector, uint32_t sectors);
+    void end();
+    bool load();
+    void create();
+
+    bool push(const uint8_t *content, uint32_t length);
+    int peek(uint32_t index, uint8_t *buffer, uint32_t size);
+    uint32_t pop(uint32_t count=1);
+
+    bool isValid() {return loaded;}
+    uint32_t count() {return num_records;}
+    uint32_t available();
+    uint32_t maxLength();
+    uint32_t sectorSize() {return flash->getSectorSize();}
+
+private:
+    typedef struct
+    {
+        uint32_t id;
+        uint32_t seq;
+    }sector_header_t;
+
+    typedef struct
+    {
+        uint16_t magic;
+        uint16_t length;
+        uint32_t crc;     //written after the content, a torn record fails it
+        uint32_t pending; //cleared once popped
+    }record_t;
+
+    Flash *flash;
+    uint32_t start_address;
+    uint32_t num_sectors;
+    uint32_t used_sectors;
+    uint32_t head;          //oldest sector in use
+    uint32_t tail;          //sector being appended to
+    uint32_t next_seq;
+    uint32_t free_address;
+    uint32_t num_records;
+    bool loaded;
+
+    uint32_t sectorAddress(uint32_t sector) {return start_address + sector*sectorSize();}
+    uint32_t nextSector(uint32_t sector) {return (sector+1) % num_sectors;}
+    uint32_t storedLength(uint32_t len);
+    uint32_t recordLength(uint32_t len) {return sizeof(record_t) + storedLength(len);}
+
+    bool findRecord(uint32_t index, uint32_t *address, record_t *record);
+    bool checkRecord(uint32_t address, const record_t *record);
+    uint32_t scanSector(uint32_t sector, uint32_t *end);
+    bool openSector(uint32_t sector);
+    void reclaim();
+    void writePadded(uint32_t address, const uint8_t *content, uint32_t length);
+};
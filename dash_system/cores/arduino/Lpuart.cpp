@@ -58,6 +58,26 @@ int Lpuart::read()
     return rxBuffer.read_char();
 }
 
+const uint8_t* Lpuart::peekSpan(int offset, int *count)
+{
+    return rxBuffer.span(offset, count);
+}
+
+int Lpuart::indexOf(uint8_t c, int start)
+{
+    return rxBuffer.indexOf(c, start);
+}
+
+void Lpuart::skip(int count)
+{
+    rxBuffer.skip(count);
+}
+
+bool Lpuart::full()
+{
+    return rxBuffer.isFull();
+}
+
 void Lpuart::begin(uint32_t baudrate)
 {
     SIM_HAL_EnableClock(SIM, gate_name);
@@ -170,3 +190,28 @@ size_t Lpuart::write(const uint8_t data)
     LPUART_HAL_Putchar(instance, data);
     return 1;
 }
+
+size_t Lpuart::write(const uint8_t *buffer, size_t size)
+{
+    if(!SIM_HAL_GetGateCmd(SIM, gate_name)) return 0;
+
+    size_t sent = 0;
+    while (sent < size)
+    {
+        uint32_t start = millis();
+        while (!LPUART_BRD_STAT_TDRE(instance))
+        {
+            if(millis() - start > 10)
+                return sent;
+        }
+
+        if(use_flowcontrol)
+        {
+            //implement timeout?
+            while(digitalRead(cts) == HIGH);
+        }
+
+        LPUART_HAL_Putchar(instance, buffer[sent++]);
+    }
+    return sent;
+}
@@ -44,10 +44,15 @@ public:
     void flush();
     void IrqHandler();
     size_t write(const uint8_t data);
+    size_t write(const uint8_t *buffer, size_t size);
     void end();
     int available();
     int peek();
     int read();
+    const uint8_t* peekSpan(int offset, int *count);
+    int indexOf(uint8_t c, int start=0);
+    void skip(int count);
+    bool full();
     operator bool() { return true; }
     using Print::write; // pull in write(str) and write(buf, size) from Print
 
@@ -38,6 +38,8 @@ public:
     virtual void begin();
     virtual void read(uint32_t address, uint8_t *buffer, size_t count);
     virtual uint8_t write(uint32_t address, uint8_t *buffer, size_t count);
+    //FlashProgram takes any run of whole write units
+    virtual uint8_t programPage(uint32_t address, uint8_t *buffer, size_t count) {return write(address, buffer, count);}
     virtual uint8_t eraseSector(uint32_t address);
     virtual uint8_t eraseAll();
 
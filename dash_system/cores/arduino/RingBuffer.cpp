@@ -84,3 +84,47 @@ bool RingBuffer::isFull()
 {
 	return (nextIndex(_iHead) == _iTail);
 }
+
+// Returns a pointer to the byte 'offset' places past the tail, with *count
+// set to the number of buffered bytes that follow it contiguously in storage
+// (up to the head or the end of the array, whichever comes first).
+const uint8_t* RingBuffer::span(int offset, int *count)
+{
+	int head = _iHead;
+	int delta = head - _iTail;
+	if(delta < 0)
+		delta += SERIAL_BUFFER_SIZE;
+
+	if(offset >= delta)
+	{
+		*count = 0;
+		return NULL;
+	}
+
+	int index = (uint32_t)(_iTail + offset) % SERIAL_BUFFER_SIZE;
+	*count = (head > index ? head : SERIAL_BUFFER_SIZE) - index;
+	return &_aucBuffer[index];
+}
+
+// Offset from the tail of the first 'c' at or after 'start', -1 if none
+int RingBuffer::indexOf(uint8_t c, int start)
+{
+	int count;
+	const uint8_t *p;
+	while((p = span(start, &count)) != NULL)
+	{
+		const uint8_t *found = (const uint8_t*)memchr(p, c, count);
+		if(found)
+			return start + (found - p);
+		start += count;
+	}
+	return -1;
+}
+
+void RingBuffer::skip(int count)
+{
+	int delta = available();
+	if(count > delta)
+		count = delta;
+	_iTail = (uint32_t)(_iTail + count) % SERIAL_BUFFER_SIZE;
+}
@@ -42,6 +42,9 @@ class RingBuffer
 	int available();
 	int peek();
 	bool isFull();
+	const uint8_t* span(int offset, int *count);
+	int indexOf(uint8_t c, int start=0);
+	void skip(int count);
 
   private:
 	int nextIndex(int index);
@@ -75,12 +75,8 @@ void SPIFlash::read(uint32_t address, uint8_t *buffer, size_t count)
 {
     if(!ready()) return;
     digitalWrite(ssPin, LOW);
-    spi->transfer(0x03);
-    spi->transfer((address >> 16) & 0xFF);
-    spi->transfer((address >> 8) & 0xFF);
-    spi->transfer(address & 0xFF);
-    for(int i=0; i<count; i++)
-        buffer[i] = spi->transfer();
+    sendAddress(0x03, address);
+    spi->read(buffer, count);
     digitalWrite(ssPin, HIGH);
 }
 
@@ -99,35 +95,42 @@ uint8_t SPIFlash::write(uint32_t address, uint8_t *buffer, size_t count)
             towrite = next_boundary - address + 1;
         count -= towrite;
 
-        enableWrites(true);
-        digitalWrite(ssPin, LOW);
-        spi->transfer(0x02);
-        spi->transfer((address >> 16) & 0xFF);
-        spi->transfer((address >> 8) & 0xFF);
-        spi->transfer(address & 0xFF);
-        for(int i=0; i<towrite; i++)
-            spi->transfer(buffer[i+offset]);
-        digitalWrite(ssPin, HIGH);
-        status = pollBusy();
-        enableWrites(false);
+        status = programPage(address, &buffer[offset], towrite);
         address += towrite;
         offset += towrite;
     }
     return status;
 }
 
+uint8_t SPIFlash::programPage(uint32_t address, uint8_t *buffer, size_t count)
+{
+    if(!ready()) return 0xFF;
+    enableWrites(true);
+    digitalWrite(ssPin, LOW);
+    sendAddress(0x02, address);
+    spi->write(buffer, count);
+    digitalWrite(ssPin, HIGH);
+    uint8_t status = pollBusy();
+    enableWrites(false);
+    return status;
+}
+
+//command and 24 bit address as one burst, the caller holds the chip select
+void SPIFlash::sendAddress(uint8_t command, uint32_t address)
+{
+    uint8_t header[4] = {command, (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address};
+    spi->write(header, sizeof(header));
+}
+
 uint8_t SPIFlash::command(uint32_t address, uint8_t command, bool addressed)
 {
     if(!ready()) return 0xFF;
     enableWrites(true);
     digitalWrite(ssPin, LOW);
-    spi->transfer(command);
     if(addressed)
-    {
-        spi->transfer((address >> 16) & 0xFF);
-        spi->transfer((address >> 8) & 0xFF);
-        spi->transfer(address & 0xFF);
-    }
+        sendAddress(command, address);
+    else
+        spi->transfer(command);
     digitalWrite(ssPin, HIGH);
     uint8_t status = pollBusy();
     enableWrites(false);
@@ -138,10 +141,7 @@ void SPIFlash::beginRead(uint32_t address)
 {
     if(!ready()) return;
     digitalWrite(ssPin, LOW);
-    spi->transfer(0x03);
-    spi->transfer((address >> 16) & 0xFF);
-    spi->transfer((address >> 8) & 0xFF);
-    spi->transfer(address & 0xFF);
+    sendAddress(0x03, address);
 }
 
 uint8_t SPIFlash::continueRead()
@@ -159,10 +159,7 @@ void SPIFlash::beginWrite(uint32_t address)
     if(!ready()) return;
     enableWrites(true);
     digitalWrite(ssPin, LOW);
-    spi->transfer(0x02);
-    spi->transfer((address >> 16) & 0xFF);
-    spi->transfer((address >> 8) & 0xFF);
-    spi->transfer(address & 0xFF);
+    sendAddress(0x02, address);
 }
 
 void SPIFlash::continueWrite(uint8_t byte)
@@ -35,6 +35,7 @@ public:
     virtual void begin();
     virtual void read(uint32_t address, uint8_t *buffer, size_t count);
     virtual uint8_t write(uint32_t address, uint8_t *buffer, size_t count);
+    virtual uint8_t programPage(uint32_t address, uint8_t *buffer, size_t count);
     virtual uint8_t eraseSector(uint32_t address) {return command(address, 0x20);}
     virtual uint8_t eraseAll() {return command(0, 0xC7, false);}
 
@@ -54,4 +55,5 @@ protected:
     void enableWrites(bool enable);
     uint8_t pollBusy();
     uint8_t command(uint32_t address, uint8_t command, bool addressed=true);
+    void sendAddress(uint8_t command, uint32_t address);
 };
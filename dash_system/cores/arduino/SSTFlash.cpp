@@ -90,8 +90,7 @@ void SSTFlash::readBlockProtect(uint8_t *buffer)
     if(!ready()) return;
     digitalWrite(ssPin, LOW);
     spi->transfer(0x72);
-    for(int i=0; i<6; i++)
-        buffer[i] = spi->transfer();
+    spi->read(buffer, 6);
     digitalWrite(ssPin, HIGH);
 }
 
@@ -120,3 +120,34 @@ uint8_t Spi::transfer(uint8_t data)
     while(SPI_RD_S_SPRF(instance) == 0);
 	return SPI_RD_DL(instance);
 }
+
+//The next byte is queued in the transmit buffer while the current one
+//shifts, so the clock never idles between bytes. Interrupts are held off
+//from queueing a byte until the one before it is read back, otherwise the
+//single receive buffer could overrun. The caller's mask is restored after
+//each byte, so a transfer from a masked context stays masked.
+void Spi::transfer(const void *txbuf, void *rxbuf, size_t count)
+{
+    if(count == 0) return;
+    const uint8_t *tx = reinterpret_cast<const uint8_t *>(txbuf);
+    uint8_t *rx = reinterpret_cast<uint8_t *>(rxbuf);
+    uint32_t primask = __get_PRIMASK();
+
+    while((SPI_RD_S_SPTEF(instance) == 0));
+    SPI_WR_DL(instance, tx ? *tx++ : 0);
+    while(--count)
+    {
+        //fetched before the store below, tx and rx may be the same buffer
+        uint8_t out = tx ? *tx++ : 0;
+        while((SPI_RD_S_SPTEF(instance) == 0));
+        __disable_irq();
+        SPI_WR_DL(instance, out);
+        while(SPI_RD_S_SPRF(instance) == 0);
+        uint8_t in = SPI_RD_DL(instance);
+        __set_PRIMASK(primask);
+        if(rx) *rx++ = in;
+    }
+    while(SPI_RD_S_SPRF(instance) == 0);
+    uint8_t in = SPI_RD_DL(instance);
+    if(rx) *rx = in;
+}
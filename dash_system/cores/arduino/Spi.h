@@ -51,6 +51,10 @@ public:
 
     uint8_t transfer(uint8_t data=0);
     inline void transfer(void *buf, size_t count);
+    //either buffer may be NULL, zeros are sent in place of tx
+    void transfer(const void *tx, void *rx, size_t count);
+    void write(const void *tx, size_t count) {transfer(tx, NULL, count);}
+    void read(void *rx, size_t count) {transfer(NULL, rx, count);}
     //
     // // Transaction Functions
     // void usingInterrupt(int interruptNumber);
@@ -89,7 +93,5 @@ private:
 
 void Spi::transfer(void *buf, size_t count)
 {
-    uint8_t *buffer = reinterpret_cast<uint8_t *>(buf);
-    for (size_t i=0; i<count; i++)
-        buffer[i] = transfer(buffer[i]);
+    transfer(buf, buf, count);
 }
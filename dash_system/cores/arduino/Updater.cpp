@@ -29,24 +29,338 @@
 #define APP_ADDRESS       0x00006000
 #define BOOT_FLAG_ADDRESS (APP_ADDRESS - FSL_FEATURE_FLASH_PFLASH_BLOCK_SECTOR_SIZE)
 
+//Delta patches, see tools/ota_delta.py
+#define PATCH_MAGIC       0x32504448  //HDP2
+#define PATCH_KEEP        'K'         //sector is unchanged
+#define PATCH_BUILD       'B'         //sector is rebuilt from later sectors and literals
+#define PATCH_STAGED      'S'         //as BUILD, but also copies from its own old content
+#define PATCH_COPY        'C'         //uint32 old offset, uint16 count
+#define PATCH_ADD         'A'         //uint16 count, literal bytes
+#define PATCH_END         'E'
+
 void Updater::init(EZPort &ezport)
 {
     this->ezport = &ezport;
     memset(&boot_flags, 0xFF, sizeof(boot_flags));
 }
 
-bool Updater::updateUserModule(uint32_t dst, uint32_t src, uint32_t count)
+//an incremental update leaves sectors that already hold the image alone
+bool Updater::updateUserModule(uint32_t dst, uint32_t src, uint32_t count, bool incremental)
+{
+    if(!ezport->ready())
+        ezport->begin();
+
+    uint32_t size = ezport->getSectorSize();
+    if((dst & (size-1)) != 0)
+        return false;
+
+    const uint8_t *image = (const uint8_t*)src;
+    uint8_t window[UPDATER_WINDOW];
+    for(uint32_t offset=0; offset<count; offset+=size)
+    {
+        uint32_t length = count - offset;
+        if(length > size) length = size;
+        if(incremental && matchUserModule(dst+offset, &image[offset], length))
+            continue;
+        if(!ezport->isSectorErased(dst+offset))
+            ezport->eraseSector(dst+offset);
+        for(uint32_t pos=0; pos<length; pos+=UPDATER_WINDOW)
+        {
+            uint32_t fill = length - pos;
+            if(fill > UPDATER_WINDOW) fill = UPDATER_WINDOW;
+            memcpy(window, &image[offset+pos], fill);
+            programWindow(dst+offset+pos, window, fill);
+        }
+    }
+    image_crc = crc32(0, image, count);
+    return verifyUserModule(dst, count, image_crc);
+}
+
+bool Updater::matchUserModule(uint32_t address, const uint8_t *data, uint32_t count)
+{
+    uint8_t window[UPDATER_WINDOW];
+    for(uint32_t pos=0; pos<count; pos+=UPDATER_WINDOW)
+    {
+        uint32_t fill = count - pos;
+        if(fill > UPDATER_WINDOW) fill = UPDATER_WINDOW;
+        ezport->read(address+pos, window, fill);
+        if(memcmp(window, &data[pos], fill) != 0)
+            return false;
+    }
+    return true;
+}
+
+//pads the write out to a whole program unit
+void Updater::programWindow(uint32_t address, uint8_t *window, uint32_t fill)
+{
+    uint32_t unit = ezport->getMaxWrite();
+    uint32_t padded = (fill + unit - 1) & ~(unit - 1);
+    memset(&window[fill], 0xFF, padded - fill);
+    ezport->write(address, window, padded);
+}
+
+//whether a whole user flash sector fits in the reserved MCU flash
+bool Updater::canStage()
+{
+    return UPDATER_SCRATCH != 0xFFFFFFFF && ezport->getSectorSize() <= UPDATER_SCRATCH_SIZE;
+}
+
+//copies the start of a user flash sector to the MCU flash scratch
+void Updater::stageUserModule(uint32_t address, uint32_t count)
+{
+    if(!MCUFLASH.ready())
+        MCUFLASH.begin();
+
+    for(uint32_t pos=0; pos<count; pos+=FSL_FEATURE_FLASH_PFLASH_BLOCK_SECTOR_SIZE)
+        MCUFLASH.eraseSector(UPDATER_SCRATCH+pos);
+    uint8_t window[UPDATER_WINDOW];
+    for(uint32_t pos=0; pos<count; pos+=UPDATER_WINDOW)
+    {
+        ezport->read(address+pos, window, UPDATER_WINDOW);
+        MCUFLASH.programPage(UPDATER_SCRATCH+pos, window, UPDATER_WINDOW);
+    }
+}
+
+//copies it back once the sector is erased
+void Updater::unstageUserModule(uint32_t address, uint32_t count)
+{
+    uint8_t window[UPDATER_WINDOW];
+    for(uint32_t pos=0; pos<count; pos+=UPDATER_WINDOW)
+    {
+        MCUFLASH.read(UPDATER_SCRATCH+pos, window, UPDATER_WINDOW);
+        ezport->write(address+pos, window, UPDATER_WINDOW);
+    }
+}
+
+//a stream ends wherever it runs dry, a short read fails the update
+static bool readStream(Stream &stream, void *buffer, uint32_t count)
+{
+    return stream.readBytes((uint8_t*)buffer, count) == count;
+}
+
+//The crc is taken as each window goes to the EZPort, then checked against
+//a read back of the whole image. An incremental update compares each window
+//with flash until one differs. A sector that differs part way through has
+//its matching start staged in MCU flash across the erase, without the
+//scratch every sector is erased and written.
+bool Updater::updateUserModule(uint32_t dst, Stream &stream, uint32_t count, bool incremental)
+{
+    if(!ezport->ready())
+        ezport->begin();
+
+    uint32_t size = ezport->getSectorSize();
+    if((dst & (size-1)) != 0 || (UPDATER_WINDOW % ezport->getMaxWrite()) != 0)
+        return false;
+    if(!canStage())
+        incremental = false;
+
+    uint8_t window[UPDATER_WINDOW];
+    uint8_t current[UPDATER_WINDOW];
+    uint32_t crc = 0;
+    for(uint32_t offset=0; offset<count; offset+=size)
+    {
+        uint32_t sector = dst + offset;
+        uint32_t length = count - offset;
+        if(length > size) length = size;
+        bool matched = incremental;
+        if(!incremental && !ezport->isSectorErased(sector))
+            ezport->eraseSector(sector);
+
+        for(uint32_t pos=0; pos<length; pos+=UPDATER_WINDOW)
+        {
+            uint32_t fill = length - pos;
+            if(fill > UPDATER_WINDOW) fill = UPDATER_WINDOW;
+            if(!readStream(stream, window, fill))
+                return false;
+            crc = crc32(crc, window, fill);
+
+            if(matched)
+            {
+                ezport->read(sector+pos, current, fill);
+                if(memcmp(window, current, fill) == 0)
+                    continue;
+                matched = false;
+                if(!ezport->isSectorErased(sector))
+                {
+                    if(pos)
+                        stageUserModule(sector, pos);
+                    ezport->eraseSector(sector);
+                    if(pos)
+                        unstageUserModule(sector, pos);
+                }
+            }
+            programWindow(sector+pos, window, fill);
+        }
+    }
+    image_crc = crc;
+    return verifyUserModule(dst, count, crc);
+}
+
+uint32_t Updater::checksumUserModule(uint32_t address, uint32_t count)
 {
     if(!ezport->ready())
         ezport->begin();
-    return ezport->copyFrom(dst, src, count);
+
+    uint8_t window[UPDATER_WINDOW];
+    uint32_t crc = 0;
+    while(count)
+    {
+        uint32_t fill = count;
+        if(fill > UPDATER_WINDOW) fill = UPDATER_WINDOW;
+        ezport->read(address, window, fill);
+        crc = crc32(crc, window, fill);
+        address += fill;
+        count -= fill;
+    }
+    return crc;
 }
 
-bool Updater::updateUserModule(uint32_t dst, Stream &stream, uint32_t count)
+//Rebuilds the user image in place, sector by sector, from the image that is
+//already there. A sector is only erased once every sector before it is
+//done, so copies may only come from the sector itself (staged in MCU flash)
+//or the ones after it.
+bool Updater::patchUserModule(uint32_t dst, Stream &patch)
 {
     if(!ezport->ready())
         ezport->begin();
-    return ezport->copyFrom(stream, dst, count);
+
+    patch_header_t header;
+    if(!readStream(patch, &header, sizeof(header)))
+        return false;
+
+    uint32_t size = ezport->getSectorSize();
+    if(header.magic != PATCH_MAGIC || header.sector_size != size || header.base != dst)
+        return false;
+    if(header.new_size == 0 || (UPDATER_WINDOW % ezport->getMaxWrite()) != 0)
+        return false;
+    //checked before anything is erased, a staged sector needs the scratch
+    if(header.staging && !canStage())
+        return false;
+    //a patch made against a different image would build garbage
+    if(checksumUserModule(dst, header.old_size) != header.old_crc)
+        return false;
+
+    uint32_t sectors = (header.new_size + size - 1) / size;
+    for(uint32_t sector=0; sector<sectors; sector++)
+    {
+        uint8_t op;
+        if(!readStream(patch, &op, 1))
+            return false;
+        if(op == PATCH_KEEP)
+            continue;
+        if(op == PATCH_STAGED)
+        {
+            if(!header.staging)
+                return false;
+            stageUserModule(dst + sector*size, size);
+        }
+        else if(op != PATCH_BUILD)
+            return false;
+        if(!patchSector(dst, sector, header, patch, op == PATCH_STAGED))
+            return false;
+    }
+    image_crc = header.new_crc;
+    return verifyUserModule(dst, header.new_size, header.new_crc);
+}
+
+//reads a whole patch once and checks its body against the header crc, so a
+//patch damaged in the download is caught before anything is erased
+bool Updater::checkPatch(Stream &patch)
+{
+    patch_header_t header;
+    if(!readStream(patch, &header, sizeof(header)) || header.magic != PATCH_MAGIC)
+        return false;
+
+    uint8_t window[UPDATER_WINDOW];
+    uint32_t crc = 0;
+    for(uint32_t pos=0; pos<header.body_size; pos+=UPDATER_WINDOW)
+    {
+        uint32_t fill = header.body_size - pos;
+        if(fill > UPDATER_WINDOW) fill = UPDATER_WINDOW;
+        if(!readStream(patch, window, fill))
+            return false;
+        crc = crc32(crc, window, fill);
+    }
+    return crc == header.body_crc;
+}
+
+bool Updater::patchSector(uint32_t dst, uint32_t sector, const patch_header_t &header, Stream &patch, bool staged)
+{
+    uint32_t size = header.sector_size;
+    uint32_t start = sector*size;
+    uint32_t length = header.new_size - start;
+    if(length > size) length = size;
+
+    uint8_t window[UPDATER_WINDOW];
+    uint32_t fill = 0;
+    uint32_t done = 0;
+    uint32_t address = dst + start;
+
+    ezport->eraseSector(address);
+    while(true)
+    {
+        uint8_t op;
+        uint32_t from = 0;
+        uint16_t count = 0;
+        if(!readStream(patch, &op, 1))
+            return false;
+        if(op == PATCH_END)
+            break;
+        if(op != PATCH_COPY && op != PATCH_ADD)
+            return false;
+        if(op == PATCH_COPY && !readStream(patch, &from, 4))
+            return false;
+        if(!readStream(patch, &count, 2))
+            return false;
+        if(done + count > length)
+            return false;
+        //earlier sectors already hold the new image
+        if(op == PATCH_COPY && (from < start || from + count > header.old_size))
+            return false;
+
+        while(count)
+        {
+            uint32_t chunk = UPDATER_WINDOW - fill;
+            if(chunk > count) chunk = count;
+            if(op == PATCH_ADD)
+            {
+                if(!readStream(patch, &window[fill], chunk))
+                    return false;
+            }
+            else
+            {
+                if(from < start + size)
+                {
+                    //this sector's old content is in the MCU flash scratch now
+                    if(!staged)
+                        return false;
+                    if(chunk > start + size - from) chunk = start + size - from;
+                    MCUFLASH.read(UPDATER_SCRATCH + (from - start), &window[fill], chunk);
+                }
+                else
+                {
+                    ezport->read(dst + from, &window[fill], chunk);
+                }
+                from += chunk;
+            }
+            fill += chunk;
+            done += chunk;
+            count -= chunk;
+
+            if(fill == UPDATER_WINDOW)
+            {
+                ezport->write(address, window, fill);
+                address += fill;
+                fill = 0;
+            }
+        }
+    }
+    if(done != length)
+        return false;
+
+    if(fill)
+        programWindow(address, window, fill);
+    return true;
 }
 
 void Updater::updateSystemBoot(Stream &stream, uint32_t count)
@@ -55,23 +369,23 @@ void Updater::updateSystemBoot(Stream &stream, uint32_t count)
 
     uint32_t dst = 0;
     uint32_t sectormask = (FSL_FEATURE_FLASH_PFLASH_BLOCK_SECTOR_SIZE-1);
-    uint8_t buffer[FSL_FEATURE_FLASH_PFLASH_BLOCK_WRITE_UNIT_SIZE];
+    uint32_t unitmask = (FSL_FEATURE_FLASH_PFLASH_BLOCK_WRITE_UNIT_SIZE-1);
+    uint8_t window[UPDATER_WINDOW];
     while(dst < count)
     {
         if((dst & sectormask) == 0)
             MCUFLASH.eraseSector(dst);
 
-        memset(buffer, 0xFF, FSL_FEATURE_FLASH_PFLASH_BLOCK_WRITE_UNIT_SIZE);
+        //the last window stops at the write unit after count, short of the flags
+        uint32_t size = count - dst;
+        if(size > UPDATER_WINDOW) size = UPDATER_WINDOW;
+        size = (size + unitmask) & ~unitmask;
 
-        for(int i=0; i<FSL_FEATURE_FLASH_PFLASH_BLOCK_WRITE_UNIT_SIZE; i++)
-        {
-            int c = stream.read();
-            if(c < 0) break;
-            buffer[i] = (uint8_t)c;
-        }
-        MCUFLASH.write(dst, buffer, FSL_FEATURE_FLASH_PFLASH_BLOCK_WRITE_UNIT_SIZE);
+        size_t got = stream.readBytes(window, size);
+        memset(&window[got], 0xFF, size-got);
+        MCUFLASH.programPage(dst, window, size);
 
-        dst += FSL_FEATURE_FLASH_PFLASH_BLOCK_WRITE_UNIT_SIZE;
+        dst += size;
     }
 }
 
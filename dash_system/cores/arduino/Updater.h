@@ -23,6 +23,7 @@
 #pragma once
 
 #include "EZPort.h"
+#include "CRC32.h"
 #include "Stream.h"
 
 #ifdef __cplusplus
@@ -33,16 +34,38 @@ extern "C"{
 }
 #endif // __cplusplus
 
+//RAM used to assemble user flash writes and to read it back, a multiple of
+//the EZPort write size
+#ifndef UPDATER_WINDOW
+#define UPDATER_WINDOW 64
+#endif
+
+//MCU flash reserved to hold a user flash sector across its erase, see
+//dash_system.ld. 0xFFFFFFFF turns incremental updates off.
+#ifndef UPDATER_SCRATCH
+#define UPDATER_SCRATCH 0x3D800
+#endif
+#define UPDATER_SCRATCH_SIZE 0x1000
+
 class Updater
 {
 public:
     void init(EZPort &ezport);
 
-    bool updateUserModule(uint32_t dst, Stream &stream, uint32_t count);
-    bool updateUserModule(uint32_t dst, uint32_t src, uint32_t count);
+    bool updateUserModule(uint32_t dst, Stream &stream, uint32_t count, bool incremental=false);
+    bool updateUserModule(uint32_t dst, uint32_t src, uint32_t count, bool incremental=false);
+    bool patchUserModule(uint32_t dst, Stream &patch);
+    bool checkPatch(Stream &patch);
+
+    //crc32 of user flash, read with EZPort fast reads
+    uint32_t checksumUserModule(uint32_t address, uint32_t count);
+    bool verifyUserModule(uint32_t address, uint32_t count, uint32_t crc) {return checksumUserModule(address, count) == crc;}
+    //crc32 of the image the last update wrote
+    uint32_t imageCRC() {return image_crc;}
 
-    bool updateUserApplication(Stream &stream, uint32_t count) {return updateUserModule(0x8000, stream, count);}
-    bool updateUserApplication(uint32_t src, uint32_t count) {return updateUserModule(0x8000, src, count);}
+    bool updateUserApplication(Stream &stream, uint32_t count, bool incremental=false) {return updateUserModule(0x8000, stream, count, incremental);}
+    bool updateUserApplication(uint32_t src, uint32_t count, bool incremental=false) {return updateUserModule(0x8000, src, count, incremental);}
+    bool patchUserApplication(Stream &patch) {return patchUserModule(0x8000, patch);}
 
     bool updateUserBoot(Stream &stream, uint32_t count) {return updateUserModule(0x0, stream, count);}
     bool updateUserBoot(uint32_t src, uint32_t count) {return updateUserModule(0x0, src, count);}
@@ -76,6 +99,28 @@ protected:
         uint32_t end_code;
     }konekt_boot_flags_t;
 
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t sector_size;
+        uint32_t base;
+        uint32_t old_size;
+        uint32_t new_size;
+        uint32_t staging;   //nonzero when sectors copy from themselves
+        uint32_t old_crc;
+        uint32_t new_crc;
+        uint32_t body_size; //bytes after the header
+        uint32_t body_crc;
+    }patch_header_t;
+
     EZPort *ezport;
     konekt_boot_flags_t boot_flags;
+    uint32_t image_crc;
+
+    bool matchUserModule(uint32_t address, const uint8_t *data, uint32_t count);
+    bool canStage();
+    void stageUserModule(uint32_t address, uint32_t count);
+    void unstageUserModule(uint32_t address, uint32_t count);
+    void programWindow(uint32_t address, uint8_t *window, uint32_t fill);
+    bool patchSector(uint32_t dst, uint32_t sector, const patch_header_t &header, Stream &patch, bool staged);
 };
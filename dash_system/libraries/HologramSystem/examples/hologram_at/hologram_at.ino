@@ -29,6 +29,19 @@
 #define MAX_TOPIC_SIZE 63
 #define MAX_READ_SIZE 64
 
+//AT+HMSEND and the queue's batches share one Cloud connection, held open
+//until idle for CLOUD_SESSION_IDLE_MS. Only for a server that takes several
+//messages per connection, see Cloud.h.
+#define USE_CLOUD_SESSION 0
+
+//the top 10KB of MCU flash is outside the image, see dash_system.ld
+//sectors 246-249 are the Updater's UPDATER_SCRATCH
+//store-and-forward queue
+#define QUEUE_SECTOR 252
+#define QUEUE_SECTORS 4
+//OTA download progress, a FlashStore takes twice its size
+#define OTA_STORE_SECTOR 250
+
 typedef enum {
   MS_STARTUP,
   MS_RUN,
@@ -41,6 +54,9 @@ uint8_t read_buffer[MAX_READ_SIZE];
 
 sms_event sms;
 
+FlashQueue message_queue(MCUFLASH);
+FlashStore ota_store(MCUFLASH);
+
 uint8_t ipc_cmd_buf[MAX_COMMAND_SIZE];
 uint8_t ipc_msg_buf[MAX_MESSAGE_SIZE];
 char ipc_topics[MAX_TOPICS][MAX_TOPIC_SIZE+1];
@@ -226,6 +242,8 @@ void processQuery(const char* query) {
     respond(query, HOLO_REV);
   } else if (strcmp(query, "+HSMS")==0) {
     respond(query, ublox.isNetworkTimeAvailable() ? ublox.getNumSMS() : 0);
+  } else if(strcmp(query, "+HMQUEUE")==0) {
+    respond(query, Cloud.queueCount());
   } else if(strcmp(query, "+HCHARGE")==0) {
     respond(query, (int)System.chargeState());
   } else {
@@ -286,6 +304,23 @@ void processCommand(const char* cmd) {
     } else {
       ERROR();
     }
+  } else if(strcmp(cmd, "+HMQUEUE")==0) {
+    //stored now, sent in batches whenever the network is up
+    if(ipc_msg_len > 0) {
+      if(!Cloud.queueFits(ipc_msg_len, ipc_topic_list, ipc_topic_count)) {
+        //a queued message is limited to CLOUD_QUEUE_RECORD_SIZE, not MAX_MESSAGE_SIZE
+        Serial.println("+HMQUEUE: TOO LARGE");
+        ERROR();
+      } else if(Cloud.queueMessage(ipc_msg_buf, ipc_msg_len, ipc_topic_list, ipc_topic_count)) {
+        OK();
+      } else {
+        ERROR();
+      }
+      ipc_msg_len = 0;
+      ipc_topic_count = 0;
+    } else {
+      ERROR();
+    }
   } else if(strcmp(cmd, "+HSMSRD")==0) {
     sendNextSMS();
   } else if(strcmp(cmd, "+HMODEMRESET")==0) {
@@ -319,7 +354,7 @@ void processSet(const char* cmd, const char* set) {
     //<data>
     int wrlen = 0;
     int wrover = 0;
-    if(sscanf(set, "%d", &wrlen) == 1) {
+    if(atscan(set, "", wrlen) == 1) {
       if(wrlen > 128) {
         ERROR();
       } else {
@@ -406,7 +441,7 @@ void processSet(const char* cmd, const char* set) {
     OK();
   } else if(strcmp(cmd, "+HLOC")==0) {
     int timeout, accuracy;
-    if(sscanf(set, "%d,%d", &timeout, &accuracy) == 2) {
+    if(atscan(set, "", timeout, accuracy) == 2) {
       if(ublox.getLocation(2,2,0,timeout,accuracy)) {
         OK();
       } else {
@@ -417,7 +452,7 @@ void processSet(const char* cmd, const char* set) {
     }
   } else if(strcmp(cmd, "+HSOCKLISTEN")==0) {
     int port;
-    if(sscanf(set, "%d", &port) == 1) {
+    if(atscan(set, "", port) == 1) {
       int socket = Cloud.listen(port);
       if(socket == 0) {
         ERROR();
@@ -429,7 +464,7 @@ void processSet(const char* cmd, const char* set) {
     }
   } else if(strcmp(cmd, "+HSOCKREAD")==0) {
     int socket, maxlen, timeout, hex;
-    if(sscanf(set, "%d,%d,%d,%d", &socket, &maxlen, &timeout, &hex) == 4) {
+    if(atscan(set, "", socket, maxlen, timeout, hex) == 4) {
       if(hex == 1) {
         if(maxlen > MAX_READ_SIZE/2) maxlen = MAX_READ_SIZE/2;
       } else {
@@ -459,7 +494,7 @@ void processSet(const char* cmd, const char* set) {
     }
   } else if(strcmp(cmd, "+HSOCKCLOSE")==0) {
     int socket;
-    if(sscanf(set, "%d", &socket) == 1) {
+    if(atscan(set, "", socket) == 1) {
       ublox.close(socket);
       OK();
     } else {
@@ -467,7 +502,7 @@ void processSet(const char* cmd, const char* set) {
     }
   } else if(strcmp(cmd, "+HPASSTHROUGH")==0) {
     int value;
-    if(sscanf(set, "%d", &value) == 1) {
+    if(atscan(set, "", value) == 1) {
       OK();
       state = MS_PASSTHROUGH;
     } else {
@@ -640,7 +675,14 @@ void initialize() {
   Serial.println(HOLO_REV);
 
   Cloud.begin(ublox, AUTH_TOTP, handle_event);
+  message_queue.begin(QUEUE_SECTOR, QUEUE_SECTORS);
+  Cloud.beginQueue(message_queue);
+  ota_store.begin(OTA_STORE_SECTOR);
+  Cloud.beginOTA(ota_store);
   ublox.begin(Cloud, SerialUBlox);
+#if USE_CLOUD_SESSION
+  Cloud.beginSession();
+#endif
 
   SerialUBlox.flush();
   state = MS_RUN;
@@ -654,6 +696,14 @@ void state_startup() {
 void state_run() {
   bool sleep = true;
   ublox.pollEvents();
+  Cloud.pollClock();
+  if(Cloud.pollQueue()) {
+    sleep = false;
+  }
+  Cloud.pollSession();
+  if(Cloud.pollOTA()) {
+    sleep = false;
+  }
   updateCharge();
 
   while(Serial.available()) {
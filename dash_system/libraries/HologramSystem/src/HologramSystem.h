@@ -23,3 +23,4 @@
 
 #include "hal/ArduinoUBlox.h"
 #include "hal/ArduinoCloud.h"
+#include "sdk/network/modem/ATScan.h"
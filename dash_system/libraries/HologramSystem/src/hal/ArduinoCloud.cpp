@@ -22,6 +22,9 @@
 */
 #include "ArduinoCloud.h"
 #include "UBloxStream.h"
+#include "UBloxSocketStream.h"
+#include "../sdk/network/modem/ATScan.h"
+#include <strings.h>
 
 Updater OTA;
 
@@ -29,6 +32,14 @@ void ArduinoCloud::begin(UBlox &ublox, AuthenticationMethod method, event_callba
     init(ublox, method);
     this->ublox = &ublox;
     event_cb = cb;
+    queue = NULL;
+    ota_store = NULL;
+    ota_pending = false;
+    clock_resync = true;
+    clock_synced = 0;
+    clock_failed = 0;
+    drift_error = 0;
+    drift_elapsed = 0;
 }
 
 const char* ArduinoCloud::getID() {
@@ -96,90 +107,406 @@ bool ArduinoCloud::convertToLocalTime(rtc_datetime_t &dest, const timestamp_tz &
     return RTC_HAL_IsDatetimeCorrectFormat(&dest);
 }
 
+//served from the RTC, network time is only read to resync it
 uint32_t ArduinoCloud::getSeconds() {
+    pollClock();
+    return isClockValid() ? Clock.counter() : 0;
+}
+
+//syncs when one is due, failures are retried every CLOUD_CLOCK_RETRY_MS
+void ArduinoCloud::pollClock() {
+    if(!clock_resync && Clock.counter() - clock_synced < CLOUD_CLOCK_RESYNC_S) return;
+    if(clock_failed && getMillis() - clock_failed < CLOUD_CLOCK_RETRY_MS) return;
+    clock_failed = syncClock() ? 0 : getMillis();
+}
+
+bool ArduinoCloud::isClockValid() {
+    return Clock.isRunning() && Clock.counter() >= CLOUD_CLOCK_EPOCH;
+}
+
+//sets the RTC to network time, the error accumulated between syncs is
+//trimmed out of the oscillator once the window is long enough
+bool ArduinoCloud::syncClock() {
     timestamp_tz ts;
-    if(!ublox->getNetworkTime(ts)) return 0;
-    return getSecondsUTC(ts);
+    if(!ublox->getNetworkTime(ts)) return false;
+    uint32_t network = getSecondsUTC(ts);
+    if(network < CLOUD_CLOCK_EPOCH) return false;
+
+    uint32_t rtc = Clock.counter();
+    int32_t error = (int32_t)(network - rtc);
+    if(clock_synced && abs(error) <= CLOUD_CLOCK_MAX_DRIFT_S) {
+        drift_error += error;
+        drift_elapsed += network - clock_synced;
+        if(drift_elapsed >= CLOUD_CLOCK_TRIM_S) {
+            Clock.trim(drift_error, drift_elapsed);
+            drift_error = 0;
+            drift_elapsed = 0;
+        }
+    }
+    if(error != 0) {
+        Clock.setCounter(network);
+    }
+    clock_synced = network;
+    clock_resync = false;
+    return true;
 }
 
-bool ArduinoCloud::downloadOTA(const char* url, const char* destination) {
-    char user[30] = "@dev_sim_";
-    char pass[20];
+uint32_t ArduinoCloud::getMillis() {
+    return millis();
+}
 
-    strcat(user, getID());
-    auth->generatePassword(getID(), getKey(), getSeconds(), pass);
+//a queue that fails to load is recreated empty
+bool ArduinoCloud::beginQueue(FlashQueue &queue) {
+    if(!queue.load()) {
+        queue.create();
+    }
+    this->queue = &queue;
+    queue_pending = queue.count() > 0;
+    return queue.isValid();
+}
 
-    return ublox->httpGet(url, 80, destination, user, pass);
+uint32_t ArduinoCloud::queueCount() {
+    return queue ? queue->count() : 0;
 }
 
-int ArduinoCloud::findBlankLine(const char* filename, int offset, char* buffer, int size) {
-    while(true) {
-        offset = ublox->readFileLine(filename, offset, buffer, size);
-        if(offset == -1)
-            break;
-        if(strlen(buffer) == 0)
-            break;
+bool ArduinoCloud::queuePush(const uint8_t* record, uint32_t length) {
+    return queue && queue->push(record, length);
+}
+
+int ArduinoCloud::queuePeek(uint32_t index, uint8_t* record, uint32_t size) {
+    return queue ? queue->peek(index, record, size) : -1;
+}
+
+uint32_t ArduinoCloud::queuePop(uint32_t count) {
+    return queue ? queue->pop(count) : 0;
+}
+
+//a new OTA starts over, the last one's file and progress are dropped
+bool ArduinoCloud::startOTA(const char* command) {
+    clearProgress();
+    if(ota_store) ota_store->add("ota.cmd", command);
+    return runOTA(command);
+}
+
+//continues a download cut short by a dropped connection or a reset
+bool ArduinoCloud::pollOTA() {
+    if(!ota_pending || !ublox->isConnected()) return false;
+    ota_pending = false;
+    String command;
+    if(!ota_store || !ota_store->find("ota.cmd", &command)) return false;
+    return runOTA(command.c_str());
+}
+
+bool ArduinoCloud::isOTAPending() {
+    String command;
+    return ota_store && ota_store->find("ota.cmd", &command);
+}
+
+bool ArduinoCloud::runOTA(const char* command) {
+    bool delta = strncmp(command, "PD:", 3) == 0;
+    const char* url = command+3;
+
+    System.userInReset(true);
+    bool downloaded = downloadOTA(url, CLOUD_OTA_FILE);
+    bool programmed = downloaded && programOTA(CLOUD_OTA_FILE, delta);
+    System.userInReset(false);
+
+    //keep an unfinished download for the next connection
+    if(downloaded || !isOTAPending()) {
+        clearProgress();
     }
-    return offset;
+    return programmed;
 }
 
-int ArduinoCloud::findLine(const char* filename, int offset, const char* linestart, char* buffer, int size) {
-    while(true) {
-        offset = ublox->readFileLine(filename, offset, buffer, size);
-        if(offset == -1)
-            break;
-        if(strncmp(buffer, linestart, strlen(linestart)) == 0)
-            break;
+bool ArduinoCloud::beginOTA(FlashStore &store) {
+    if(!store.load()) {
+        store.create(1);
     }
-    return offset;
+    ota_store = &store;
+
+    String pos;
+    ota.offset = 0;
+    ota.total = -1;
+    ota.crc = 0;
+    ota.etag[0] = 0;
+    if(store.find("ota.pos", &pos)) {
+        atscan(pos.c_str(), "", ota.offset, ota.total, ATHex(ota.crc));
+        String etag;
+        if(store.find("ota.etag", &etag))
+            strncpy(ota.etag, etag.c_str(), sizeof(ota.etag)-1);
+    }
+    ota_pending = isOTAPending();
+    return store.isValid();
 }
 
-bool ArduinoCloud::findContent(const char* filename, int* contentLength, int* contentOffset) {
-    char header[80];
+void ArduinoCloud::saveProgress() {
+    if(!ota_store) return;
+    String pos = String(ota.offset) + "," + String(ota.total) + "," + String(ota.crc, HEX);
+    ota_store->add("ota.pos", pos);
+    ota_store->add("ota.etag", ota.etag);
+}
 
-    int offset = ublox->readFileLine(filename, 0, header, 80);
-    if(offset == -1) return false;
-    if(strcmp(header, "HTTP/1.1 200 OK") != 0) return false;
+void ArduinoCloud::clearProgress() {
+    if(ota_store) {
+        ota_store->remove("ota.cmd");
+        ota_store->remove("ota.pos");
+        ota_store->remove("ota.etag");
+    }
+    restartProgress(CLOUD_OTA_FILE);
+}
 
-    offset = findLine("ota", 0, "Content-Length:", header, 80);
-    if(offset == -1) return false;
-    if(sscanf(header, "Content-Length: %d", contentLength) != 1) return false;
+void ArduinoCloud::restartProgress(const char* destination) {
+    ublox->deleteFile(destination);
+    ota.offset = 0;
+    ota.total = -1;
+    ota.crc = 0;
+    ota.etag[0] = 0;
+}
 
-    offset = findBlankLine("ota", offset, header, 80);
-    if(offset == -1) return false;
-    *contentOffset = offset;
+//the file starts over when it is shorter than the saved offset, anything
+//written after the last save is read back into the crc and kept
+bool ArduinoCloud::syncProgress(const char* destination) {
+    int size = ublox->filesize(destination);
+    if(size < 0) size = 0;
+    if(size < ota.offset || (ota.total >= 0 && size > ota.total)) {
+        restartProgress(destination);
+        saveProgress();
+        return true;
+    }
 
+    uint8_t block[CLOUD_OTA_BLOCK_SIZE];
+    while(ota.offset < size) {
+        int toread = size - ota.offset;
+        if(toread > CLOUD_OTA_BLOCK_SIZE) toread = CLOUD_OTA_BLOCK_SIZE;
+        int got = ublox->readFile(destination, ota.offset, block, toread);
+        if(got <= 0) return false;
+        ota.crc = crc32(ota.crc, block, got);
+        ota.offset += got;
+    }
     return true;
 }
 
-bool ArduinoCloud::programOTA(const char* filename) {
-    //find start of content and content length
-    int contentLength = 0;
-    int contentOffset = 0;
-    if(findContent("ota", &contentLength, &contentOffset)) {
-        //do OTA update
-        System.onLED();
-        OTA.init(EZPORT);
-        UBloxStream ustream(ublox, "ota", contentOffset, contentLength);
-        OTA.updateUserApplication(ustream, contentLength);
-        EZPORT.end();
-        System.offLED();
+//fetches the image a range at a time, stopping once too many connections
+//in a row make no progress
+bool ArduinoCloud::downloadOTA(const char* url, const char* destination) {
+    int failures = 0;
+    while(failures < CLOUD_OTA_ATTEMPTS) {
+        if(!ublox->isConnected()) return false;
+        if(!syncProgress(destination)) return false;
+        if(ota.total >= 0 && ota.offset == ota.total) return true;
+
+        int before = ota.offset;
+        if(!fetchRange(url, destination)) {
+            //refused, retrying won't help
+            if(ota_store) ota_store->remove("ota.cmd");
+            return false;
+        }
+        if(ota.offset == before) failures++;
+        else failures = 0;
+    }
+    return false;
+}
+
+static void printBase64(Print &out, const char* text) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    int len = strlen(text);
+    for(int i=0; i<len; i+=3) {
+        uint32_t n = (uint8_t)text[i] << 16;
+        if(i+1 < len) n |= (uint8_t)text[i+1] << 8;
+        if(i+2 < len) n |= (uint8_t)text[i+2];
+        out.write(alphabet[(n >> 18) & 0x3F]);
+        out.write(alphabet[(n >> 12) & 0x3F]);
+        out.write(i+1 < len ? alphabet[(n >> 6) & 0x3F] : '=');
+        out.write(i+2 < len ? alphabet[n & 0x3F] : '=');
+    }
+}
+
+//one ranged GET, appends what arrives and saves progress once the range is
+//complete and the file length agrees, false when the server refuses
+bool ArduinoCloud::fetchRange(const char* url, const char* destination) {
+    const char* path = strchr(url, '/');
+    char host[64];
+    if(path == NULL || path - url >= (int)sizeof(host)) return false;
+    memcpy(host, url, path - url);
+    host[path - url] = 0;
+
+    char auth_user[30] = "@dev_sim_";
+    char auth_pass[20];
+    char credentials[sizeof(auth_user) + sizeof(auth_pass)];
+    strcat(auth_user, getID());
+    auth->generatePassword(getID(), getKey(), getSeconds(), auth_pass);
+    strcpy(credentials, auth_user);
+    strcat(credentials, ":");
+    strcat(credentials, auth_pass);
+
+    int last = ota.offset + CLOUD_OTA_CHUNK_SIZE - 1;
+    if(ota.total >= 0 && last >= ota.total) last = ota.total - 1;
+
+    //no socket, a failed attempt like any other that makes no progress
+    int socket = ublox->open(host, 80);
+    if(socket <= 0) return true;
+    UBloxSocketStream stream(ublox, socket);
+    stream.print("GET ");
+    stream.print(path);
+    stream.print(" HTTP/1.1\r\nHost: ");
+    stream.print(host);
+    stream.print("\r\nAuthorization: Basic ");
+    printBase64(stream, credentials);
+    stream.print("\r\nRange: bytes=");
+    stream.print(ota.offset);
+    stream.print('-');
+    stream.print(last);
+    if(ota.etag[0]) {
+        stream.print("\r\nIf-Range: ");
+        stream.print(ota.etag);
+    }
+    stream.print("\r\nConnection: close\r\n\r\n");
+    stream.flush();
+
+    http_header header;
+    bool accepted = true;
+    if(readHeader(stream, &header)) {
+        accepted = receiveRange(stream, header, destination);
+    }
+    ublox->close(socket);
+    return accepted;
+}
+
+bool ArduinoCloud::receiveRange(UBloxSocketStream &stream, const http_header &header, const char* destination) {
+    int skip = 0;
+    int total = -1;
+    if(header.status == 206) {
+        if(header.range_start != ota.offset || header.range_total <= 0) return true;
+        total = header.range_total;
+    } else if(header.status == 200) {
+        //no range support, or the image changed and If-Range sent all of it
+        if(header.content_length <= 0) return false;
+        if(ota.offset && strcmp(header.etag, ota.etag) != 0)
+            restartProgress(destination);
+        skip = ota.offset;
+        total = header.content_length;
+    } else {
+        return false;
+    }
+    if(ota.offset && ota.total != total) {
+        //a different image under the same url
+        restartProgress(destination);
+        return true;
+    }
+    ota.total = total;
+    strcpy(ota.etag, header.etag);
+
+    uint8_t block[CLOUD_OTA_BLOCK_SIZE];
+    int remaining = header.content_length - skip;
+    while(skip) {
+        int got = stream.readBytes(block, skip < CLOUD_OTA_BLOCK_SIZE ? skip : CLOUD_OTA_BLOCK_SIZE);
+        if(got <= 0) return true;
+        skip -= got;
+    }
+    int next_save = ota.offset + CLOUD_OTA_CHUNK_SIZE;
+    while(remaining > 0) {
+        int got = stream.readBytes(block, remaining < CLOUD_OTA_BLOCK_SIZE ? remaining : CLOUD_OTA_BLOCK_SIZE);
+        if(got <= 0) break;
+        if(!ublox->appendFile(destination, block, got)) break;
+        ota.crc = crc32(ota.crc, block, got);
+        ota.offset += got;
+        remaining -= got;
+        if(remaining == 0 || ota.offset >= next_save) {
+            if(ublox->filesize(destination) == ota.offset)
+                saveProgress();
+            next_save = ota.offset + CLOUD_OTA_CHUNK_SIZE;
+        }
+    }
+    return true;
+}
+
+//value of a response header line if it is the named header, NULL otherwise
+static const char* headerValue(const char* line, const char* name) {
+    int len = strlen(name);
+    if(strncasecmp(line, name, len) != 0 || line[len] != ':') return NULL;
+    line += len+1;
+    while(*line == ' ') line++;
+    return line;
+}
+
+//consumes the response header in one pass, leaving the stream at the body
+bool ArduinoCloud::readHeader(Stream &stream, http_header *header) {
+    char line[80];
+    int len = 0;
+    int lines = 0;
+    header->status = 0;
+    header->content_length = -1;
+    header->range_start = 0;
+    header->range_total = -1;
+    header->etag[0] = 0;
+
+    while(stream.available()) {
+        int c = stream.read();
+        if(c != '\n') {
+            if(len < sizeof(line)-1) line[len++] = c;
+            continue;
+        }
+        if(len && line[len-1] == '\r') len--;
+        line[len] = 0;
+        len = 0;
+
+        const char* value;
+        if(lines++ == 0) {
+            if(strncmp(line, "HTTP/1.", 7) != 0) return false;
+            header->status = atoi(&line[8]);
+        } else if(line[0] == 0) {
+            return header->status != 0;
+        } else if((value = headerValue(line, "Content-Length"))) {
+            header->content_length = atoi(value);
+        } else if((value = headerValue(line, "ETag"))) {
+            strncpy(header->etag, value, sizeof(header->etag)-1);
+            header->etag[sizeof(header->etag)-1] = 0;
+        } else if((value = headerValue(line, "Content-Range"))) {
+            //bytes first-last/total
+            char* end;
+            if(strncmp(value, "bytes ", 6) != 0) continue;
+            header->range_start = strtol(value+6, &end, 10);
+            end = strchr(end, '/');
+            if(end) header->range_total = strtol(end+1, NULL, 10);
+        }
     }
+    return false;
+}
+
+//the file holds the body alone, a delta body is a patch against the
+//installed image, see tools/ota_delta.py. The Updater checks what it wrote
+//by reading it back, a full image must also match what was downloaded.
+//A full image is written incrementally, see UPDATER_SCRATCH. A patch is
+//read through once to check its crc before the Updater erases anything.
+bool ArduinoCloud::programOTA(const char* filename, bool delta) {
+    int size = ublox->filesize(filename);
+    if(size <= 0) return false;
+
+    System.onLED();
+    OTA.init(EZPORT);
+    bool updated = true;
+    if(delta) {
+        UBloxStream check(ublox, filename, 0, size);
+        updated = OTA.checkPatch(check);
+    }
+    if(updated) {
+        UBloxStream ustream(ublox, filename, 0, size);
+        updated = delta ? OTA.patchUserApplication(ustream)
+                        : OTA.updateUserApplication(ustream, size, true);
+    }
+    if(updated && !delta && size == ota.total)
+        updated = OTA.imageCRC() == ota.crc;
+    EZPORT.end();
+    System.offLED();
+    return updated;
 }
 
 bool ArduinoCloud::checkOTA(int index, sms_event &ota_sms) {
     const char* payload = auth->validateCommand(ota_sms.message, getID(), getKey(), getSeconds());
     if(payload) {
         ublox->deleteSMS(index);
-        if(strncmp(payload, "PF:", 3) == 0) { //OTA message
-            System.userInReset(true);
-            const char* url = payload+3;
-            if(downloadOTA(url, "ota")) {
-                if(programOTA("ota")) {
-
-                }
-            }
-            System.userInReset(false);
+        if(strncmp(payload, "PF:", 3) == 0 || strncmp(payload, "PD:", 3) == 0) { //OTA message
+            startOTA(payload);
         }
         return true;
     }
@@ -197,11 +524,24 @@ void ArduinoCloud::onNetworkEvent(uint32_t id, const void* content) {
             }
         }
     }
+    if(e == UBLOX_EVENT_CONNECTED) {
+        queue_pending = true;
+        ota_pending = isOTAPending();
+    }
+    //synced from pollClock, not while the URC is being dispatched
+    if(e == UBLOX_EVENT_NETWORK_TIME_UPDATE || e == UBLOX_EVENT_NETWORK_REGISTERED) {
+        clock_resync = true;
+        clock_failed = 0;
+    }
     if(event_cb)
         event_cb(e, c);
 }
 
 void ArduinoCloud::onPowerUp() {
+    //a reset modem may carry a different model or SIM
+    invalidateHeader();
+    iccid[0] = 0;
+    imsi[0] = 0;
     if(DASH_1_2) digitalWrite(TXL_ON_N, HIGH);
 }
 
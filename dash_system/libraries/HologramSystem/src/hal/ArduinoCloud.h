@@ -24,6 +24,61 @@
 
 #include "../sdk/cloud/Cloud.h"
 #include "ArduinoUBlox.h"
+#include "UBloxSocketStream.h"
+
+//the RTC is trusted once past this (2017-01-01), a reset RTC counts from 1
+#ifndef CLOUD_CLOCK_EPOCH
+#define CLOUD_CLOCK_EPOCH 1483228800
+#endif
+
+#ifndef CLOUD_CLOCK_RESYNC_S
+#define CLOUD_CLOCK_RESYNC_S (6*60*60)
+#endif
+
+//a failed sync waits this long before the next AT+CCLK
+#ifndef CLOUD_CLOCK_RETRY_MS
+#define CLOUD_CLOCK_RETRY_MS 60000
+#endif
+
+//drift is trimmed once measured over this long, shorter can't resolve a tick
+#ifndef CLOUD_CLOCK_TRIM_S
+#define CLOUD_CLOCK_TRIM_S (24*60*60)
+#endif
+
+//larger differences are a clock step, not drift
+#define CLOUD_CLOCK_MAX_DRIFT_S 60
+
+//OTA images are fetched in ranges of this size, progress is saved after each
+#ifndef CLOUD_OTA_CHUNK_SIZE
+#define CLOUD_OTA_CHUNK_SIZE (32*1024)
+#endif
+
+//connections in a row without progress before waiting for the next one
+#ifndef CLOUD_OTA_ATTEMPTS
+#define CLOUD_OTA_ATTEMPTS 5
+#endif
+
+#ifndef CLOUD_OTA_BLOCK_SIZE
+#define CLOUD_OTA_BLOCK_SIZE 512
+#endif
+
+#define CLOUD_OTA_FILE "ota"
+#define CLOUD_OTA_ETAG_SIZE 48
+
+typedef struct {
+    int status;
+    int content_length;
+    int range_start;
+    int range_total;    //-1 when not given
+    char etag[CLOUD_OTA_ETAG_SIZE];
+}http_header;
+
+typedef struct {
+    int offset;         //bytes of the image in the file
+    int total;          //image length, -1 until the server gives it
+    uint32_t crc;       //crc32 of the first offset bytes
+    char etag[CLOUD_OTA_ETAG_SIZE];
+}ota_progress;
 
 typedef void (*event_callback)(ublox_event_id id, const ublox_event_content *content);
 
@@ -40,24 +95,56 @@ public:
 
     bool checkOTA(int index, sms_event &ota_sms);
 
+    bool syncClock();
+    void pollClock();
+    bool isClockValid();
+
+    bool beginQueue(FlashQueue &queue);
+    virtual uint32_t queueCount();
+
+    bool beginOTA(FlashStore &store);
+    bool pollOTA();
+    bool isOTAPending();
+
 protected:
     virtual const char* getID();
     virtual const char* getKey();
     virtual const char* getHost();
     virtual int getPort();
     virtual uint32_t getSeconds();
+    virtual uint32_t getMillis();
 
+    virtual bool queuePush(const uint8_t* record, uint32_t length);
+    virtual int queuePeek(uint32_t index, uint8_t* record, uint32_t size);
+    virtual uint32_t queuePop(uint32_t count);
+
+    bool startOTA(const char* command);
+    bool runOTA(const char* command);
     bool downloadOTA(const char* url, const char* destination);
-    bool programOTA(const char* filename);
-    int findLine(const char* filename, int offset, const char* linestart, char* buffer, int size);
-    bool findContent(const char* filename, int* contentLength, int* contentOffset);
-    int findBlankLine(const char* filename, int offset, char* buffer, int size);
+    bool fetchRange(const char* url, const char* destination);
+    bool receiveRange(UBloxSocketStream &stream, const http_header &header, const char* destination);
+    bool syncProgress(const char* destination);
+    void saveProgress();
+    void clearProgress();
+    void restartProgress(const char* destination);
+    bool programOTA(const char* filename, bool delta=false);
+    bool readHeader(Stream &stream, http_header *header);
 
     char imsi[20];
     char iccid[20];
 
     event_callback event_cb;
     UBlox *ublox;
+    FlashQueue *queue;
+    FlashStore *ota_store;
+    ota_progress ota;
+    bool ota_pending;
+
+    bool clock_resync;
+    uint32_t clock_synced;  //network seconds at the last sync, 0 before one
+    uint32_t clock_failed;  //getMillis() at the last failed sync, 0 after a good one
+    int32_t drift_error;
+    uint32_t drift_elapsed;
     sms_event sms;
 };
 
@@ -22,25 +22,38 @@
 */
 #include "ArduinoModem.h"
 #include "delay.h"
+#include <cstring>
 
 ArduinoModem::ArduinoModem()
-: uart(NULL) {
+: uart(NULL), stream(NULL), scanned(0), scan_tail(NULL), copy_count(0) {
 }
 
-void ArduinoModem::begin(Stream &uart, URCReceiver &receiver, Stream *debug) {
+void ArduinoModem::begin(Lpuart &uart, URCReceiver &receiver, Stream *debug) {
     this->uart = &uart;
+    this->stream = &uart;
     this->debug = debug;
+    scanned = 0;
+    copy_count = 0;
+    init(receiver);
+}
+
+void ArduinoModem::begin(Stream &stream, URCReceiver &receiver, Stream *debug) {
+    this->uart = NULL;
+    this->stream = &stream;
+    this->debug = debug;
+    scanned = 0;
+    copy_count = 0;
     init(receiver);
 }
 
 void ArduinoModem::modemout(const char* str) {
     debugout(str);
-    uart->print(str);
+    stream->print(str);
 }
 
 void ArduinoModem::modemout(char c) {
     debugout(c);
-    uart->write(c);
+    stream->write(c);
 }
 
 void ArduinoModem::modemout(uint8_t b) {
@@ -52,7 +65,12 @@ void ArduinoModem::modemout(uint8_t b) {
             default: debugout((char)b);
         }
     }
-    uart->write(b);
+    stream->write(b);
+}
+
+void ArduinoModem::modemout(const uint8_t* data, uint32_t length) {
+    debugout((const char*)data, length);
+    stream->write(data, length);
 }
 
 void ArduinoModem::debugout(const char* str) {
@@ -73,16 +91,159 @@ void ArduinoModem::debugout(int i) {
     }
 }
 
+void ArduinoModem::debugout(const char* str, uint32_t len) {
+    if(debug) {
+        debug->write((const uint8_t*)str, len);
+    }
+}
+
 int ArduinoModem::modemavailable() {
+    if(!uart) return copy_count + stream->available();
     return uart->available();
 }
 
 uint8_t ArduinoModem::modemread() {
-    return (uint8_t)uart->read();
+    scanned = 0;
+    if(!uart && copy_count) {
+        uint8_t c = copy_buffer[0];
+        modemskip(1);
+        return c;
+    }
+    return (uint8_t)stream->read();
+}
+
+//copies out of the uart receive buffer a contiguous span at a time
+int ArduinoModem::modemreadblock(uint8_t* buffer, int length) {
+    if(!uart) {
+        int count = copy_count < length ? copy_count : length;
+        memcpy(buffer, copy_buffer, count);
+        modemskip(count);
+        while(count < length && stream->available()) {
+            buffer[count++] = (uint8_t)stream->read();
+        }
+        return count;
+    }
+    int copied = 0;
+    while(copied < length) {
+        int count;
+        const uint8_t *p = uart->peekSpan(0, &count);
+        if(count == 0) break;
+        if(count > length - copied) count = length - copied;
+        memcpy(&buffer[copied], p, count);
+        uart->skip(count);
+        copied += count;
+    }
+    if(copied) scanned = 0;
+    return copied;
+}
+
+//scans the uart receive buffer in place for the next '\n', resuming where
+//the last unsuccessful scan stopped. Anything reading the uart directly
+//moves its read position, which starts the scan over.
+bool ArduinoModem::modemline(ModemLine &line) {
+    if(!uart) return copyLine(line);
+    int count;
+    const uint8_t *tail = uart->peekSpan(0, &count);
+    if(tail != scan_tail || scanned > uart->available()) {
+        scanned = 0;
+    }
+    int end = uart->indexOf('\n', scanned);
+    int consumed = end + 1;
+    if(end < 0) {
+        int avail = uart->available();
+        if(!uart->full()) {
+            scanned = avail;
+            scan_tail = tail;
+            return false;
+        }
+        //no terminator will fit, hand over what is there
+        end = avail;
+        consumed = avail;
+    }
+
+    viewLine(line, end, consumed);
+    while(line.size() && line.at(line.size()-1) == '\r') {
+        if(line.length[1]) {
+            line.length[1]--;
+        } else {
+            line.length[0]--;
+        }
+    }
+    return true;
+}
+
+//views everything buffered so far, terminated or not
+bool ArduinoModem::modemhead(ModemLine &line) {
+    if(!uart) {
+        fillCopy();
+        if(copy_count == 0) return false;
+        line.data[0] = copy_buffer;
+        line.length[0] = copy_count;
+        line.data[1] = NULL;
+        line.length[1] = 0;
+        line.consumed = copy_count;
+        return true;
+    }
+    int avail = uart->available();
+    if(avail == 0) {
+        return false;
+    }
+    viewLine(line, avail, avail);
+    return true;
+}
+
+void ArduinoModem::viewLine(ModemLine &line, int end, int consumed) {
+    int count;
+    line.data[0] = (const char*)uart->peekSpan(0, &count);
+    line.length[0] = count < end ? count : end;
+    line.length[1] = end - line.length[0];
+    line.data[1] = line.length[1] ? (const char*)uart->peekSpan(line.length[0], &count) : NULL;
+    line.consumed = consumed;
+}
+
+void ArduinoModem::modemskip(uint32_t count) {
+    scanned = 0;
+    if(uart) {
+        uart->skip(count);
+        return;
+    }
+    uint32_t n = count < (uint32_t)copy_count ? count : copy_count;
+    memmove(copy_buffer, &copy_buffer[n], copy_count - n);
+    copy_count -= n;
+    for(; n < count && stream->available(); n++) {
+        stream->read();
+    }
 }
 
 uint8_t ArduinoModem::modempeek() {
-    return (uint8_t)uart->peek();
+    if(!uart && copy_count) return (uint8_t)copy_buffer[0];
+    return (uint8_t)stream->peek();
+}
+
+//moves what the stream has into copy_buffer
+void ArduinoModem::fillCopy() {
+    while(copy_count < ARDUINO_MODEM_COPY_SIZE && stream->available()) {
+        copy_buffer[copy_count++] = (char)stream->read();
+    }
+}
+
+//modemline() for a Stream, the line is copied into copy_buffer first
+bool ArduinoModem::copyLine(ModemLine &line) {
+    fillCopy();
+    const char *nl = (const char*)memchr(copy_buffer, '\n', copy_count);
+    int end = nl ? nl - copy_buffer : copy_count;
+    if(!nl && copy_count < ARDUINO_MODEM_COPY_SIZE) {
+        return false;
+    }
+    line.consumed = nl ? end + 1 : end;
+    while(end && copy_buffer[end-1] == '\r') {
+        end--;
+    }
+    line.data[0] = copy_buffer;
+    line.length[0] = end;
+    line.data[1] = NULL;
+    line.length[1] = 0;
+    return true;
 }
 
 uint32_t ArduinoModem::msTick() {
@@ -23,25 +23,47 @@
 #pragma once
 
 #include "../sdk/network/modem/Modem.h"
-#include "Stream.h"
+#include "Lpuart.h"
+
+#ifndef ARDUINO_MODEM_COPY_SIZE
+#define ARDUINO_MODEM_COPY_SIZE 256 //longest line when begun on a Stream
+#endif
 
 class ArduinoModem : public Modem {
 public:
     ArduinoModem();
-    void begin(Stream &uart, URCReceiver &reciever, Stream *debug=NULL);
+    //lines are scanned in place in the uart receive buffer
+    void begin(Lpuart &uart, URCReceiver &reciever, Stream *debug=NULL);
+    //any other Stream, lines are copied out of it a byte at a time
+    void begin(Stream &stream, URCReceiver &reciever, Stream *debug=NULL);
 
 protected:
     virtual void modemout(char c);
     virtual void modemout(const char* str);
     virtual void modemout(uint8_t b);
+    virtual void modemout(const uint8_t* data, uint32_t length);
     virtual void debugout(const char* str);
     virtual void debugout(char c);
     virtual void debugout(int i);
+    virtual void debugout(const char* str, uint32_t len);
     virtual int modemavailable();
     virtual uint8_t modemread();
     virtual uint8_t modempeek();
+    virtual int modemreadblock(uint8_t* buffer, int length);
+    virtual bool modemline(ModemLine &line);
+    virtual bool modemhead(ModemLine &line);
+    virtual void modemskip(uint32_t count);
     virtual uint32_t msTick();
 
-    Stream *uart;
+    Lpuart *uart;   //NULL when begun on a Stream
+    Stream *stream; //the uart, or the Stream begun on
     Stream *debug;
+    void viewLine(ModemLine &line, int end, int consumed);
+    int scanned;
+    const uint8_t *scan_tail; //read position when scanned was taken
+
+    void fillCopy();
+    bool copyLine(ModemLine &line);
+    char copy_buffer[ARDUINO_MODEM_COPY_SIZE];
+    int copy_count;
 };
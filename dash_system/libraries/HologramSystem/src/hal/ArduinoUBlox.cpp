@@ -22,12 +22,42 @@
 */
 #include "ArduinoUBlox.h"
 
-void ArduinoUBlox::begin(NetworkEventHandler &h, Stream &modem_uart, Stream *uart) {
+void ArduinoUBlox::begin(NetworkEventHandler &h, Lpuart &modem_uart, Stream *uart) {
     modem.begin(modem_uart, *this);
     this->uart = uart;
     init(h, modem);
 }
 
+void ArduinoUBlox::begin(NetworkEventHandler &h, Stream &modem_stream, Stream *uart) {
+    modem.begin(modem_stream, *this);
+    this->uart = uart;
+    init(h, modem);
+}
+
+//moves what is waiting in either direction between stream and the direct
+//link socket, returns the number of bytes moved or -1 if not in direct link
+int ArduinoUBlox::pumpDirectLink(Stream &stream) {
+    if(!isDirectLink()) return -1;
+    uint8_t buffer[64];
+    int moved = 0;
+
+    int count = directRead(buffer, sizeof(buffer));
+    if(count > 0) {
+        stream.write(buffer, count);
+        moved += count;
+    }
+
+    count = 0;
+    while(count < sizeof(buffer) && stream.available()) {
+        buffer[count++] = stream.read();
+    }
+    if(count) {
+        directWrite(buffer, count);
+        moved += count;
+    }
+    return moved;
+}
+
 void ArduinoUBlox::wait(uint32_t ms) {
     delay(ms);
 }
@@ -28,7 +28,9 @@
 
 class ArduinoUBlox : public UBlox {
 public:
-    void begin(NetworkEventHandler &h, Stream &modem_uart, Stream *uart=NULL);
+    void begin(NetworkEventHandler &h, Lpuart &modem_uart, Stream *uart=NULL);
+    void begin(NetworkEventHandler &h, Stream &modem_stream, Stream *uart=NULL);
+    int pumpDirectLink(Stream &stream);
 protected:
     virtual void wait(uint32_t ms);
     virtual void holdReset();
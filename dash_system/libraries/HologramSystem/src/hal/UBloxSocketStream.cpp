@@ -0,0 +1,82 @@
+/*
+  UBloxSocketStream.cpp - Class definitions that provide Arduino Stream
+  compatibility for ublox sockets on the Dash.
+
+  https://hologram.io
+
+  Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "UBloxSocketStream.h"
+#include <string.h>
+
+UBloxSocketStream::UBloxSocketStream(UBlox *u, int socket, uint32_t timeout)
+: ublox(u), socket(socket), timeout(timeout), buff_loc(0), buffered(0){}
+
+//waits up to the timeout for more, 0 once the socket is closed or idle
+int UBloxSocketStream::available()
+{
+    if(!fill()) return 0;
+    return buffered - buff_loc;
+}
+
+bool UBloxSocketStream::fill()
+{
+    if(buff_loc < buffered) return true;
+    int got = ublox->read(socket, UBLOXSOCKETSTREAM_BUFFER_SIZE, buffer, timeout);
+    buffered = got > 0 ? got : 0;
+    buff_loc = 0;
+    return buffered != 0;
+}
+
+int UBloxSocketStream::read()
+{
+    if(!fill()) return -1;
+    return buffer[buff_loc++];
+}
+
+int UBloxSocketStream::peek()
+{
+    if(!fill()) return -1;
+    return buffer[buff_loc];
+}
+
+//buffered bytes first, the rest straight from the socket into dst
+size_t UBloxSocketStream::readBytes(char *dst, size_t length)
+{
+    size_t numread = buffered - buff_loc;
+    if(numread > length) numread = length;
+    memcpy(dst, &buffer[buff_loc], numread);
+    buff_loc += numread;
+
+    while(numread < length) {
+        int got = ublox->read(socket, length - numread, (uint8_t*)&dst[numread], timeout);
+        if(got <= 0) break;
+        numread += got;
+    }
+    return numread;
+}
+
+size_t UBloxSocketStream::write(const uint8_t *buffer, size_t size)
+{
+    return ublox->write(socket, buffer, size) ? size : 0;
+}
+
+void UBloxSocketStream::flush()
+{
+    ublox->flush(socket);
+}
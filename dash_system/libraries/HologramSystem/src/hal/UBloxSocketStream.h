@@ -0,0 +1,55 @@
+/*
+  UBloxSocketStream.h - Class definitions that provide Arduino Stream
+  compatibility for ublox sockets on the Dash.
+
+  https://hologram.io
+
+  Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "Stream.h"
+#include "ArduinoUBlox.h"
+
+#ifndef UBLOXSOCKETSTREAM_BUFFER_SIZE
+#define UBLOXSOCKETSTREAM_BUFFER_SIZE 128
+#endif
+
+class UBloxSocketStream : public Stream
+{
+public:
+    UBloxSocketStream(UBlox *u, int socket, uint32_t timeout=10000);
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+    virtual void flush();
+    virtual size_t write(uint8_t c) {return write(&c, 1);}
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    virtual size_t readBytes(char *dst, size_t length);
+    using Stream::readBytes;
+protected:
+    bool fill();
+
+    UBlox *ublox;
+    int socket;
+    uint32_t timeout;
+    int buff_loc;
+    int buffered;
+    uint8_t buffer[UBLOXSOCKETSTREAM_BUFFER_SIZE];
+};
@@ -21,35 +21,74 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
-#include "UbloxStream.h"
+#include "UBloxStream.h"
 #include "Arduino.h"
 
 UBloxStream::UBloxStream(UBlox *u, const char * filename, unsigned int offset, unsigned int bytes)
-: reader(u), filename(filename), offset(offset), bytes(bytes), fill_loc(0), buff_loc(0), buffered(0){}
+: reader(u), filename(filename), offset(offset), bytes(bytes), fill_loc(0), buff_loc(0), buffered(0), requested(0){}
+
+//collects a block still in flight so it isn't taken for unsolicited output
+UBloxStream::~UBloxStream()
+{
+    if(requested)
+        reader->receiveFile(buffer, requested);
+}
 
 int UBloxStream::available()
 {
     return (bytes - fill_loc) + (buffered - buff_loc);
 }
 
+bool UBloxStream::request()
+{
+    if(fill_loc >= bytes) return false;
+    int size = min(bytes - fill_loc, UBLOXSTREAM_BUFFER_SIZE);
+    if(!reader->requestFile(filename, offset + fill_loc, size)) return false;
+    requested = size;
+    return true;
+}
+
+//takes the block in flight once the buffer is used up and requests the
+//next, which then transfers while the caller consumes this one
+bool UBloxStream::fill()
+{
+    if(buff_loc < buffered) return true;
+    if(requested == 0 && !request()) return false;
+
+    int got = reader->receiveFile(buffer, requested);
+    bool complete = (got == requested);
+    buffered = got > 0 ? got : 0;
+    buff_loc = 0;
+    requested = 0;
+    fill_loc += buffered;
+
+    if(complete)
+        request();
+    return buffered != 0;
+}
+
 int UBloxStream::read()
 {
-    if(!available()) return 0;
-    if(buff_loc >= buffered)
+    if(!fill()) return 0;
+    return buffer[buff_loc++];
+}
+
+//whole blocks at a time, stops short where the file ends
+size_t UBloxStream::readBytes(char *dst, size_t length)
+{
+    size_t count = 0;
+    while(count < length && fill())
     {
-        buffered = reader->readFile(filename, offset + fill_loc, buffer,
-                                    min(bytes - fill_loc, UBLOXSTREAM_BUFFER_SIZE));
-        if(buffered == 0) return 0;
-        buff_loc = 0;
-        fill_loc += buffered;
+        size_t chunk = min(buffered - buff_loc, length - count);
+        memcpy(&dst[count], &buffer[buff_loc], chunk);
+        buff_loc += chunk;
+        count += chunk;
     }
-
-    return buffer[buff_loc++];
+    return count;
 }
 
 int UBloxStream::peek()
 {
-    int r = read();
-    --buff_loc;
-    return r;
+    if(!fill()) return 0;
+    return buffer[buff_loc];
 }
@@ -30,13 +30,21 @@ class UBloxStream : public Stream
 {
 public:
     UBloxStream(UBlox *u, const char* filename, unsigned int offset, unsigned int bytes);
+    ~UBloxStream();
     virtual int available();
     virtual int read();
     virtual int peek();
+    virtual size_t readBytes(char *dst, size_t length);
+    using Stream::readBytes;
     virtual void flush(){}
     virtual size_t write(uint8_t){return 0;}
 protected:
-    #define UBLOXSTREAM_BUFFER_SIZE 32
+    //the next block is requested as soon as one is taken and waits in the
+    //uart ring, so it has to fit there along with its response header
+    #define UBLOXSTREAM_BUFFER_SIZE (SERIAL_BUFFER_SIZE/2)
+    bool fill();
+    bool request();
+
     UBlox *reader;
     int fill_loc;
     unsigned int buff_loc;
@@ -44,5 +52,6 @@ protected:
     int offset;
     unsigned int bytes;
     unsigned int buffered;
-    char buffer[UBLOXSTREAM_BUFFER_SIZE];
+    int requested; //size of the block in flight, 0 when none
+    uint8_t buffer[UBLOXSTREAM_BUFFER_SIZE];
 };
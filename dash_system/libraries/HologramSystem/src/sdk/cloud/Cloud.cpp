@@ -25,6 +25,12 @@
 void Cloud::init(Network &network, AuthenticationMethod method) {
     this->network = &network;
     this->auth = AuthenticationFactory::getAuthentication(method);
+    session = false;
+    session_socket = -1;
+    batch_socket = -1;
+    batch_count = 0;
+    queue_pending = false;
+    invalidateHeader();
 }
 
 bool Cloud::sendMessage(const char* content) {
@@ -55,37 +61,348 @@ bool Cloud::sendMessage(const uint8_t* content, uint32_t length, const char* top
     if(!network->isConnected())
         return false;
 
-    uint8_t response[3] = {0,0,0};
-    int socket = network->open(getHost(), getPort());
+    for(int attempt=0; attempt<2; attempt++) {
+        int previous = session ? session_socket : -1;
+        int socket = connect();
+        if(socket <= 0) return false;
+        bool sent = writeMessage(socket, content, length, topics, numtags) && readAck(socket);
+        bool dropped = !network->isOpen(socket);
+        disconnect(socket, !sent);
+        if(sent) return true;
+        //only a reused session socket the server closed is worth a retry
+        if(socket != previous || !dropped) break;
+    }
+    return false;
+}
+
+bool Cloud::beginSession(uint32_t idle_ms) {
+    session = true;
+    session_idle = idle_ms;
+    session_last = getMillis();
+    return network->isConnected();
+}
+
+void Cloud::endSession() {
+    session = false;
+    if(session_socket > 0) {
+        network->close(session_socket);
+    }
+    session_socket = -1;
+}
+
+bool Cloud::beginBatch() {
+    if(batch_socket > 0) return false;
+    batch_count = 0;
+    batch_ok = true;
+    if(!network->isConnected()) return false;
+    batch_socket = connect();
+    if(batch_socket <= 0) {
+        batch_socket = -1;
+        return false;
+    }
+    return true;
+}
+
+int Cloud::add(const char* content, const char* topics[], uint32_t numtopics) {
+    return add((const uint8_t*)content, strlen(content), topics, numtopics);
+}
+
+//returns the message's index in the batch, -1 if it was not sent
+int Cloud::add(const uint8_t* content, uint32_t length, const char* topics[], uint32_t numtopics) {
+    if(batch_socket <= 0 || !batch_ok) return -1;
+    if(batch_count >= CLOUD_BATCH_SIZE) return -1;
+    if(!writeMessage(batch_socket, content, length, topics, numtopics)) {
+        //a partial message leaves the stream unusable
+        batch_ok = false;
+        return -1;
+    }
+    return batch_count++;
+}
+
+//collects one ack per message in order, results[i] is set for each added
+//message, returns the number of messages acknowledged
+int Cloud::commitBatch(bool results[]) {
+    if(batch_socket <= 0) return 0;
+
+    uint8_t acks[CLOUD_BATCH_SIZE*2];
+    int total = batch_count*2;
+    int numread = 0;
+    network->flush(batch_socket);
+    uint32_t start = getMillis();
+    while(numread < total) {
+        uint32_t elapsed = getMillis() - start;
+        if(elapsed >= CLOUD_ACK_TIMEOUT_MS) break;
+        int r = network->read(batch_socket, total-numread, &acks[numread], CLOUD_ACK_TIMEOUT_MS - elapsed);
+        if(r <= 0) break;
+        numread += r;
+    }
+
+    int acked = 0;
+    for(int i=0; i<batch_count; i++) {
+        bool ok = (i*2+1 < numread) && (acks[i*2] == '0') && (acks[i*2+1] == '0');
+        if(ok) acked++;
+        if(results) results[i] = ok;
+    }
+
+    disconnect(batch_socket, !batch_ok || numread != total);
+    batch_socket = -1;
+    batch_count = 0;
+    return acked;
+}
+
+bool Cloud::queueMessage(const char* content, const char* topics[], uint32_t numtopics) {
+    return queueMessage((const uint8_t*)content, strlen(content), topics, numtopics);
+}
+
+//whether a message of length bytes with these topics fits in one record
+bool Cloud::queueFits(uint32_t length, const char* topics[], uint32_t numtopics) {
+    if(numtopics > CLOUD_QUEUE_MAX_TOPICS) return false;
+    uint32_t size = 1 + length;
+    for(int i=0; i<numtopics; i++) {
+        size += strlen(topics[i])+1;
+    }
+    return size <= CLOUD_QUEUE_RECORD_SIZE;
+}
+
+//record layout: topic count, each topic null terminated, then the content
+bool Cloud::queueMessage(const uint8_t* content, uint32_t length, const char* topics[], uint32_t numtopics) {
+    if(!queueFits(length, topics, numtopics)) return false;
+    uint32_t size = 1;
+    queue_record[0] = numtopics;
+    for(int i=0; i<numtopics; i++) {
+        uint32_t topiclen = strlen(topics[i])+1;
+        memcpy(&queue_record[size], topics[i], topiclen);
+        size += topiclen;
+    }
+    memcpy(&queue_record[size], content, length);
+    size += length;
+
+    if(!queuePush(queue_record, size)) return false;
+    queue_pending = true;
+    return true;
+}
+
+//splits a queued record into its topics and content, returns the content offset
+static int parseRecord(const uint8_t* record, int length, const char* topics[], uint32_t &numtopics) {
+    if(length < 1) return -1;
+    numtopics = record[0];
+    if(numtopics > CLOUD_QUEUE_MAX_TOPICS) return -1;
+    int offset = 1;
+    for(int i=0; i<numtopics; i++) {
+        const uint8_t* end = (const uint8_t*)memchr(&record[offset], 0, length-offset);
+        if(end == NULL) return -1;
+        topics[i] = (const char*)&record[offset];
+        offset = end - record + 1;
+    }
+    return offset;
+}
+
+//uploads one batch of the oldest queued messages, acked ones are popped in
+//order so delivery is at least once, returns the number delivered or -1.
+//Several messages only share a connection in a session, see beginSession.
+int Cloud::drainQueue() {
+    uint32_t pending = queueCount();
+    if(pending == 0) return 0;
+    if(!session) return sendQueued(pending);
+    if(!beginBatch()) return -1;
+
+    const char* topics[CLOUD_QUEUE_MAX_TOPICS];
+    uint32_t numtopics = 0;
+    uint32_t added = 0;
+    bool unreadable = false;
+    while(added < pending && added < CLOUD_BATCH_SIZE) {
+        int length = queuePeek(added, queue_record, sizeof(queue_record));
+        int offset = parseRecord(queue_record, length, topics, numtopics);
+        if(offset < 0) {
+            unreadable = true;
+            break;
+        }
+        if(add(&queue_record[offset], length-offset, topics, numtopics) < 0) break;
+        added++;
+    }
+
+    bool results[CLOUD_BATCH_SIZE];
+    commitBatch(results);
+    uint32_t delivered = 0;
+    while(delivered < added && results[delivered]) delivered++;
+    if(delivered < added || (!unreadable && added == 0)) {
+        queuePop(delivered);
+        return -1;
+    }
+    //an unreadable record would stall the queue, it is dropped
+    queuePop(unreadable ? delivered+1 : delivered);
+    return delivered;
+}
+
+//one message per connection, each popped as soon as it is acked
+int Cloud::sendQueued(uint32_t pending) {
+    const char* topics[CLOUD_QUEUE_MAX_TOPICS];
+    uint32_t numtopics = 0;
+    uint32_t delivered = 0;
+    while(delivered < pending && delivered < CLOUD_BATCH_SIZE) {
+        int length = queuePeek(0, queue_record, sizeof(queue_record));
+        int offset = parseRecord(queue_record, length, topics, numtopics);
+        if(offset < 0) {
+            //an unreadable record would stall the queue, it is dropped
+            queuePop(1);
+            break;
+        }
+        if(!sendMessage(&queue_record[offset], length-offset, topics, numtopics)) return -1;
+        queuePop(1);
+        delivered++;
+    }
+    return delivered;
+}
+
+//drains a batch per call while connected, returns true while there is more
+//to send; after a failed batch it waits for the next connection or message
+bool Cloud::pollQueue() {
+    if(!queue_pending) return false;
+    if(!network->isConnected()) return false;
+    if(queueCount() == 0 || drainQueue() < 0) {
+        queue_pending = false;
+    }
+    return queue_pending;
+}
+
+//closes the session connection once idle, it reopens on the next message
+void Cloud::pollSession() {
+    if(session_socket <= 0) return;
+    if(!network->isOpen(session_socket) || (getMillis() - session_last >= session_idle)) {
+        network->close(session_socket);
+        session_socket = -1;
+    }
+}
+
+//the session socket when it is still open (+UUSOCL clears it), or a new one
+int Cloud::connect() {
+    if(session) {
+        pollSession();
+        if(session_socket > 0) {
+            return session_socket;
+        }
+        session_socket = network->open(getHost(), getPort());
+        return session_socket;
+    }
+    return network->open(getHost(), getPort());
+}
+
+void Cloud::disconnect(int socket, bool force) {
+    if(session && socket == session_socket && !force) {
+        session_last = getMillis();
+        return;
+    }
+    if(socket == session_socket) {
+        session_socket = -1;
+    }
+    network->close(socket);
+}
+
+bool Cloud::writeMessage(int socket, const uint8_t* content, uint32_t length, const char* topics[], uint32_t numtags) {
+    const uint8_t terminator[2] = {0,0};
     auth->writeAuth(content, length, getID(), getKey(), getSeconds(), *this, socket);
-    network->write(socket, " M");
-    network->write(socket, &metadata_version, 1);
-    network->write(socket, "dash-");
-    network->write(socket, network->getModel());
-    network->write(socket, "-");
-    network->write(socket, FIRMWARE_VERSION_STRING);
-    network->write(socket, "\n");
-    for(int i=0; i<numtags; i++) {
-        network->write(socket, "T");
-        network->write(socket, topics[i]);
+    if(encodeHeader(topics, numtags)) {
+        network->write(socket, header, header_len);
+    } else {
+        network->write(socket, " M");
+        network->write(socket, &metadata_version, 1);
+        network->write(socket, "dash-");
+        network->write(socket, network->getModel());
+        network->write(socket, "-");
+        network->write(socket, FIRMWARE_VERSION_STRING);
         network->write(socket, "\n");
+        for(int i=0; i<numtags; i++) {
+            network->write(socket, "T");
+            network->write(socket, topics[i]);
+            network->write(socket, "\n");
+        }
+        network->write(socket, "B");
     }
-    network->write(socket, "B");
-    const uint8_t escapechar = '\\';
-    for(int i=0; i<length; i++) {
-        if(content[i] == 0) {
-            network->write(socket, "\\0");
-        } else if(content[i] == escapechar) {
-            network->write(socket, "\\\\");
-        } else {
-            network->write(socket, &content[i], 1);
+    if(!writeEscaped(socket, content, length)) return false;
+    return network->write(socket, terminator, 2);
+}
+
+bool Cloud::appendHeader(uint32_t &at, const char* s) {
+    uint32_t len = strlen(s);
+    if(at + len > CLOUD_HEADER_SIZE) return false;
+    memcpy(&header[at], s, len);
+    at += len;
+    return true;
+}
+
+//the metadata is encoded once per modem power up, the topics only when they
+//differ from the previous message's
+bool Cloud::encodeHeader(const char* topics[], uint32_t numtopics) {
+    if(header_meta == 0) {
+        uint32_t at = 0;
+        appendHeader(at, " M");
+        header[at++] = metadata_version;
+        if(!appendHeader(at, "dash-") || !appendHeader(at, network->getModel()) ||
+            !appendHeader(at, "-") || !appendHeader(at, FIRMWARE_VERSION_STRING) ||
+            !appendHeader(at, "\n")) {
+            return false;
         }
+        header_meta = at;
+        header_len = 0;
     }
-    network->write(socket, response, 2);
+    if(header_len && matchTopics(topics, numtopics)) return true;
+
+    header_len = 0;
+    uint32_t at = header_meta;
+    for(int i=0; i<numtopics; i++) {
+        if(!appendHeader(at, "T") || !appendHeader(at, topics[i]) || !appendHeader(at, "\n"))
+            return false;
+    }
+    if(!appendHeader(at, "B")) return false;
+    header_len = at;
+    return true;
+}
+
+bool Cloud::matchTopics(const char* topics[], uint32_t numtopics) {
+    uint32_t at = header_meta;
+    for(int i=0; i<numtopics; i++) {
+        uint32_t len = strlen(topics[i]);
+        if(at + len + 2 >= header_len) return false;
+        if(header[at] != 'T' || header[at+len+1] != '\n') return false;
+        if(memcmp(&header[at+1], topics[i], len) != 0) return false;
+        at += len + 2;
+    }
+    return at == header_len - 1;
+}
+
+static const uint8_t escapechar = '\\';
+
+static inline bool needsEscape(uint8_t c) {
+    return c == 0 || c == escapechar;
+}
+
+//body bytes on the wire, 0 and \ go out as two byte escapes
+uint32_t Cloud::escapedLength(const uint8_t* content, uint32_t length) {
+    uint32_t escaped = length;
+    for(uint32_t i=0; i<length; i++) {
+        if(needsEscape(content[i])) escaped++;
+    }
+    return escaped;
+}
+
+//writes runs that need no escaping as one span each
+bool Cloud::writeEscaped(int socket, const uint8_t* content, uint32_t length) {
+    uint32_t start = 0;
+    for(uint32_t i=0; i<length; i++) {
+        if(!needsEscape(content[i])) continue;
+        if(i > start && !network->write(socket, &content[start], i-start)) return false;
+        if(!network->write(socket, content[i] == 0 ? "\\0" : "\\\\")) return false;
+        start = i+1;
+    }
+    if(length > start) return network->write(socket, &content[start], length-start);
+    return true;
+}
+
+bool Cloud::readAck(int socket) {
+    uint8_t response[3] = {0,0,0};
     network->flush(socket);
     int numread = network->read(socket, 2, response);
     response[2] = 0;
-    network->close(socket);
     return((numread == 2) && (strcmp("00", (const char*)response) == 0));
 }
 
@@ -28,6 +28,30 @@
 #include "../network/Network.h"
 #include "../Authentication.h"
 
+#ifndef CLOUD_SESSION_IDLE_MS
+#define CLOUD_SESSION_IDLE_MS 30000
+#endif
+
+#ifndef CLOUD_BATCH_SIZE
+#define CLOUD_BATCH_SIZE 8
+#endif
+
+#define CLOUD_ACK_TIMEOUT_MS 10000
+
+//largest queued message, content plus its topics. A record is assembled in
+//RAM, so this is also the .bss the queue costs. Anything larger has to be
+//sent with sendMessage instead.
+#ifndef CLOUD_QUEUE_RECORD_SIZE
+#define CLOUD_QUEUE_RECORD_SIZE 512
+#endif
+
+#define CLOUD_QUEUE_MAX_TOPICS 10
+
+//encoded metadata and topics, longer headers are written piecewise
+#ifndef CLOUD_HEADER_SIZE
+#define CLOUD_HEADER_SIZE 256
+#endif
+
 class Cloud : public AuthenticationWriter {
 public:
     void init(Network &network, AuthenticationMethod method);
@@ -38,8 +62,37 @@ public:
     bool sendMessage(const uint8_t* content, uint32_t length, const char* topic);
     bool sendMessage(const uint8_t* content, uint32_t length, const char* topics[], uint32_t numtopics);
 
+    //Session, keeps one connection open across messages. This relies on the
+    //server reading framed messages back to back on one TCP connection and
+    //acking each with its own two bytes, instead of closing after the first.
+    //A reused connection the server did close is retried once on a new one.
+    bool beginSession(uint32_t idle_ms=CLOUD_SESSION_IDLE_MS);
+    void endSession();
+    bool inSession() {return session;}
+    void pollSession();
+
+    //Batch, messages are written back to back and acked together. Needs the
+    //same server behaviour as a session, with the acks in message order.
+    bool beginBatch();
+    int add(const char* content, const char* topics[]=NULL, uint32_t numtopics=0);
+    int add(const uint8_t* content, uint32_t length, const char* topics[]=NULL, uint32_t numtopics=0);
+    int commitBatch(bool results[]=NULL);
+
+    //Store-and-forward, messages are kept in persistent storage until acked
+    bool queueMessage(const char* content, const char* topics[]=NULL, uint32_t numtopics=0);
+    bool queueMessage(const uint8_t* content, uint32_t length, const char* topics[]=NULL, uint32_t numtopics=0);
+    bool queueFits(uint32_t length, const char* topics[]=NULL, uint32_t numtopics=0);
+    int drainQueue();
+    bool pollQueue();
+    virtual uint32_t queueCount(){return 0;}
+
     void acknowledgeAccept(int socket);
 
+    static uint32_t escapedLength(const uint8_t* content, uint32_t length);
+
+    //drops the cached header, the model can change across a modem reset
+    void invalidateHeader() {header_meta = 0; header_len = 0;}
+
     int listen(int port);
 
     virtual bool write(int id, const char* content);
@@ -56,4 +109,35 @@ protected:
     virtual const char* getHost(){return "";}
     virtual int getPort(){return 0;}
     virtual uint32_t getSeconds(){return 0;}
+    virtual uint32_t getMillis(){return 0;}
+
+    virtual bool queuePush(const uint8_t* record, uint32_t length){return false;}
+    virtual int queuePeek(uint32_t index, uint8_t* record, uint32_t size){return -1;}
+    virtual uint32_t queuePop(uint32_t count){return 0;}
+
+    int connect();
+    void disconnect(int socket, bool force=false);
+    int sendQueued(uint32_t pending);
+    bool writeMessage(int socket, const uint8_t* content, uint32_t length, const char* topics[], uint32_t numtopics);
+    bool readAck(int socket);
+    bool writeEscaped(int socket, const uint8_t* content, uint32_t length);
+    bool encodeHeader(const char* topics[], uint32_t numtopics);
+    bool matchTopics(const char* topics[], uint32_t numtopics);
+    bool appendHeader(uint32_t &at, const char* s);
+
+    bool session;
+    int session_socket;
+    uint32_t session_idle;
+    uint32_t session_last;
+
+    int batch_socket;
+    uint32_t batch_count;
+    bool batch_ok;
+
+    uint8_t header[CLOUD_HEADER_SIZE];
+    uint32_t header_meta; //metadata length, 0 until encoded
+    uint32_t header_len;  //with the topics and body marker, 0 when stale
+
+    bool queue_pending;
+    uint8_t queue_record[CLOUD_QUEUE_RECORD_SIZE];
 };
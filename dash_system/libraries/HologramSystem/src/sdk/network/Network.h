@@ -58,6 +58,10 @@ public:
     virtual int read(int socket, int numbytes, uint8_t *buffer, uint32_t timeout)=0;
     virtual int read(int socket, int numbytes, uint8_t *buffer, uint32_t timeout, bool hex)=0;
     virtual bool close(int socket)=0;
+    virtual bool isOpen(int socket)=0;
+    virtual int openUDP(int port=0)=0;
+    virtual bool sendTo(int socket, const char* host, int port, const uint8_t* content, int length)=0;
+    virtual int recvFrom(int socket, uint8_t *buffer, int numbytes, char* host, int *port, uint32_t timeout)=0;
 protected:
     NetworkEventHandler *eventHandler;
 };
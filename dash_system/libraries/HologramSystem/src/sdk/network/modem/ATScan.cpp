@@ -0,0 +1,119 @@
+/*
+  ATScan.cpp - Typed field scanner for AT command responses.
+
+  https://hologram.io
+
+  Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "ATScan.h"
+
+static bool atspace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool ATScanner::prefix(const char* pre) {
+    while(*pre) {
+        if(*p++ != *pre++) return false;
+    }
+    return true;
+}
+
+//step over the separator in front of every field but the first
+bool ATScanner::next() {
+    if(first) {
+        first = false;
+    } else {
+        if(*p != ',') return false;
+        p++;
+    }
+    while(*p == ' ') p++;
+    return true;
+}
+
+//a field ends at a separator or the end of the line, trailing space allowed
+bool ATScanner::end(const char* q) {
+    while(atspace(*q)) q++;
+    if(*q != ',' && *q != 0) return false;
+    p = q;
+    return true;
+}
+
+bool ATScanner::field(int &value) {
+    if(!next()) return false;
+    const char* q = p;
+    bool neg = (*q == '-');
+    if(*q == '-' || *q == '+') q++;
+    if(*q < '0' || *q > '9') return false;
+    int v = 0;
+    while(*q >= '0' && *q <= '9') {
+        v = v*10 + (*q++ - '0');
+    }
+    if(!end(q)) return false;
+    value = neg ? -v : v;
+    return true;
+}
+
+bool ATScanner::field(const ATHex &hex) {
+    if(!next()) return false;
+    const char* q = p;
+    uint32_t v = 0;
+    int digits = 0;
+    for(;;) {
+        char c = *q;
+        if(c >= '0' && c <= '9') c -= '0';
+        else if(c >= 'A' && c <= 'F') c -= 'A' - 10;
+        else if(c >= 'a' && c <= 'f') c -= 'a' - 10;
+        else break;
+        v = (v << 4) | c;
+        digits++;
+        q++;
+    }
+    if(digits == 0 || !end(q)) return false;
+    hex.value = v;
+    return true;
+}
+
+bool ATScanner::field(const ATString &str) {
+    if(!next()) return false;
+    const char* q = p;
+    char term = ',';
+    if(*q == '"') {
+        term = '"';
+        q++;
+    }
+    int len = 0;
+    while(*q && *q != term) {
+        if(len < str.size-1) str.dst[len++] = *q;
+        q++;
+    }
+    if(term == '"') {
+        if(*q != '"') return false;
+        q++;
+    }
+    if(str.size > 0) str.dst[len] = 0;
+    return end(q);
+}
+
+bool ATScanner::field(const ATSkip &skip) {
+    if(!next()) return false;
+    bool quoted = false;
+    while(*p && (quoted || *p != ',')) {
+        if(*p == '"') quoted = !quoted;
+        p++;
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+  ATScan.h - Typed field scanner for AT command responses.
+
+  https://hologram.io
+
+  Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+//Typed replacement for sscanf on AT responses. Fields are comma separated
+//and converted in order in a single pass over the line, e.g.
+//  int sock, len;
+//  if(atscan(modem->lastResponse(), "+USOWR: ", sock, len) == 2) ...
+//Returns the number of fields converted, 0 if the prefix does not match.
+
+//hexadecimal integer field
+struct ATHex {
+    ATHex(uint32_t &v) : value(v) {}
+    uint32_t &value;
+};
+
+//string field, quotes are stripped, truncated to size-1 and terminated
+struct ATString {
+    ATString(char *d, int s) : dst(d), size(s) {}
+    char *dst;
+    int size;
+};
+
+//field that must be present but is not converted
+struct ATSkip {};
+
+class ATScanner {
+public:
+    ATScanner(const char* line) : p(line), first(true) {}
+
+    bool prefix(const char* pre);
+    bool field(int &value);
+    bool field(const ATHex &hex);
+    bool field(const ATString &str);
+    bool field(const ATSkip &skip);
+
+    //remainder of the line after the last converted field
+    const char* rest() const {return p;}
+
+protected:
+    bool next();
+    bool end(const char* q);
+
+    const char* p;
+    bool first;
+};
+
+inline int atscanFields(ATScanner &scanner) {
+    return 0;
+}
+
+template<typename T, typename... Fields>
+int atscanFields(ATScanner &scanner, T &&value, Fields&&... fields) {
+    if(!scanner.field(value)) return 0;
+    return 1 + atscanFields(scanner, fields...);
+}
+
+template<typename... Fields>
+int atscan(const char* line, const char* prefix, Fields&&... fields) {
+    if(line == NULL) return 0;
+    ATScanner scanner(line);
+    if(!scanner.prefix(prefix)) return 0;
+    return atscanFields(scanner, fields...);
+}
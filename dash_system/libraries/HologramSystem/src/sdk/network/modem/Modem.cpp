@@ -24,17 +24,84 @@
 #include <cstring>
 #include <cstdio>
 
+URCArgs::URCArgs(const char* urc)
+: num(0) {
+    const char* p = strchr(urc, ':');
+    if(p == NULL) return;
+    p++;
+    if(*p == ' ') p++;
+    if(*p == 0) return;
+
+    while(num < URC_MAX_ARGS) {
+        const char* end;
+        if(*p == '"') {
+            p++;
+            end = strchr(p, '"');
+            if(end == NULL) end = p + strlen(p);
+            fields[num] = p;
+            lengths[num++] = end - p;
+            if(*end == '"') end++;
+        } else {
+            end = p;
+            while(*end && *end != ',') end++;
+            fields[num] = p;
+            lengths[num++] = end - p;
+        }
+        if(*end != ',') break;
+        p = end + 1;
+    }
+}
+
+int URCArgs::toInt(int i) const {
+    if(i >= num) return 0;
+    const char* p = fields[i];
+    const char* end = p + lengths[i];
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    int value = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        value = value*10 + (*p++ - '0');
+    }
+    return negative ? -value : value;
+}
+
+bool URCArgs::equals(int i, const char* str) const {
+    if(i >= num) return false;
+    return strlen(str) == lengths[i] && strncmp(fields[i], str, lengths[i]) == 0;
+}
+
+int URCArgs::copy(int i, char* dst, int size) const {
+    int len = (i < num) ? lengths[i] : 0;
+    if(len > size-1) len = size-1;
+    memcpy(dst, field(i), len);
+    dst[len] = 0;
+    return len;
+}
+
 void Modem::init(URCReceiver &receiver) {
     this->receiver = &receiver;
-    async_state = MODEM_OK;
+    queue_head = 0;
+    queue_count = 0;
+    queue_sent = false;
+    queue_running = false;
     urc_read = 0;
     urc_write = 0; 
+    urc_truncated = 0;
+    fragment_size = 0;
+    directlink = false;
 }
 
 uint32_t Modem::timeoutCount() {
     return timeout_count;
 }
 
+uint32_t Modem::truncatedURCs() {
+    return urc_truncated;
+}
+
 const char* Modem::lastResponse() {
     return respbuffer;
 }
@@ -62,8 +129,7 @@ void Modem::appendSet(uint8_t *value, uint32_t len) {
 }
 
 modem_result Modem::intermediateSet(char expected, uint32_t timeout, uint32_t retries) {
-    checkURC();
-    if(async_state == MODEM_BUSY) return MODEM_BUSY;
+    if(!waitQueue(timeout)) return MODEM_BUSY;
     do {
         respbuffer[0] = 0;
         modemwrite(cmdbuffer, CMD_STARTAT);
@@ -101,6 +167,124 @@ modem_result Modem::intermediateSet(char expected, uint32_t timeout, uint32_t re
     return MODEM_TIMEOUT;
 }
 
+//sends the set and waits for its '+CMD: <fields>,"' header, leaving the
+//binary payload that follows in the receive buffer for dataRead()
+//the payload opens at the given count of quotes, so quoted header fields
+//can be stepped over, the header is available from lastResponse()
+modem_result Modem::headerSet(uint32_t timeout, int quotes) {
+    modem_result r = sendSet();
+    if(r != MODEM_OK) return r;
+    return waitHeader(timeout, quotes);
+}
+
+//writes the set without waiting, the response is collected by waitHeader()
+//and nothing else may use the modem in between
+modem_result Modem::sendSet() {
+    if(!waitQueue(1000)) return MODEM_BUSY;
+    respbuffer[0] = 0;
+    *valoffset = 0;
+    modemwrite(cmdbuffer, CMD_STARTAT);
+    modemwrite("=");
+    modemwrite(valbuffer, CMD_END);
+    return MODEM_OK;
+}
+
+//the payload follows the header on the same line and can be larger than
+//the receive buffer, so the header is taken as soon as it is buffered
+//rather than once the line ends
+modem_result Modem::waitHeader(uint32_t timeout, int quotes) {
+    uint32_t startMillis = msTick();
+    ModemLine line;
+    while(msTick() - startMillis < timeout) {
+        if(modemhead(line) && takeHeader(line, quotes)) {
+            timeout_count = 0;
+            return MODEM_OK;
+        }
+        if(!modemline(line)) {
+            continue;
+        }
+        debugline("{", line, "}\r\n");
+        modem_result r = processLine(line, cmdbuffer, 0);
+        modemskip(line.consumed);
+        if(r != MODEM_BUSY) {
+            return r == MODEM_OK ? MODEM_NO_MATCH : r;
+        }
+    }
+    timeout_count++;
+    return MODEM_TIMEOUT;
+}
+
+//consumes the header up to and including its opening quote, only the
+//header is logged, never the binary payload behind it
+bool Modem::takeHeader(const ModemLine &line, int quotes) {
+    if(!commandResponseMatch(cmdbuffer, line)) return false;
+    uint32_t quote = 0;
+    for(int seen=0; quote < line.size(); quote++) {
+        char c = line.at(quote);
+        if(c == '\n') return false;
+        if(c == '"' && ++seen == quotes) break;
+    }
+    if(quote >= line.size()) return false;
+
+    uint32_t len = quote < sizeof(respbuffer) ? quote : sizeof(respbuffer)-1;
+    for(uint32_t i=0; i<len; i++) {
+        respbuffer[i] = line.at(i);
+    }
+    respbuffer[len] = 0;
+    debugout(">HEADER: '");
+    debugout(respbuffer);
+    debugout("'\r\n");
+    modemskip(quote+1);
+    return true;
+}
+
+//sends the set and waits for CONNECT, after which the uart carries raw
+//data and AT parsing is suspended until disconnect()
+modem_result Modem::connectSet(uint32_t timeout) {
+    if(!waitQueue(timeout)) return MODEM_BUSY;
+    respbuffer[0] = 0;
+    *valoffset = 0;
+    modemwrite(cmdbuffer, CMD_STARTAT);
+    modemwrite("=");
+    modemwrite(valbuffer, CMD_END);
+
+    uint32_t startMillis = msTick();
+    ModemLine line;
+    while(findline(line, timeout, startMillis)) {
+        if(line.equals("CONNECT")) {
+            modemskip(line.consumed);
+            timeout_count = 0;
+            directlink = true;
+            return MODEM_OK;
+        }
+        modem_result r = processLine(line, cmdbuffer, 0);
+        modemskip(line.consumed);
+        if(r != MODEM_BUSY) {
+            return r == MODEM_OK ? MODEM_NO_MATCH : r;
+        }
+    }
+    timeout_count++;
+    return MODEM_TIMEOUT;
+}
+
+//after the escape sequence, waits for DISCONNECT and resumes AT parsing
+//raw data still arriving ahead of it is dropped
+modem_result Modem::disconnect(uint32_t timeout) {
+    if(!directlink) return MODEM_OK;
+    directlink = false;
+
+    uint32_t startMillis = msTick();
+    ModemLine line;
+    while(findline(line, timeout, startMillis)) {
+        bool done = line.equals("DISCONNECT");
+        modemskip(line.consumed);
+        if(done) {
+            return MODEM_OK;
+        }
+    }
+    return MODEM_TIMEOUT;
+}
+
 modem_result Modem::waitSetComplete(uint32_t timeout, uint32_t retries)
 {
     return waitSetComplete(NULL, timeout, retries);
@@ -136,28 +320,50 @@ modem_result Modem::completeSet(const char* expected, uint32_t timeout, uint32_t
     set(cmdbuffer, valbuffer, expected, timeout, retries);
 }
 
-bool Modem::findline(char *buffer, uint32_t timeout, uint32_t startMillis) {
-    char *rx = buffer;
+bool ModemLine::equals(const char* str) const {
+    uint32_t len = strlen(str);
+    return len == size() && startsWith(str);
+}
+
+bool ModemLine::startsWith(const char* str, uint32_t offset, bool nocase) const {
+    for(uint32_t i=offset; *str; i++, str++) {
+        if(i >= size()) return false;
+        char c1 = at(i);
+        char c2 = *str;
+        if(nocase) {
+            if(c1 >= 'a' && c1 <= 'z') c1 -= 32;
+            if(c2 >= 'a' && c2 <= 'z') c2 -= 32;
+        }
+        if(c1 != c2) return false;
+    }
+    return true;
+}
+
+uint32_t ModemLine::copy(char* dst, uint32_t size) const {
+    uint32_t len = this->size();
+    if(len > size-1) len = size-1;
+    uint32_t first = len < length[0] ? len : length[0];
+    memcpy(dst, data[0], first);
+    memcpy(&dst[first], data[1], len-first);
+    dst[len] = 0;
+    return len;
+}
+
+void Modem::debugline(const char* prefix, const ModemLine &line, const char* suffix) {
+    debugout(prefix);
+    debugout(line.data[0], line.length[0]);
+    debugout(line.data[1], line.length[1]);
+    debugout(suffix);
+}
+
+//waits for a complete line to be buffered, the caller must modemskip() it
+bool Modem::findline(ModemLine &line, uint32_t timeout, uint32_t startMillis) {
     while (msTick() - startMillis < timeout) {
-        while(modemavailable()) {
-            *rx = modemread();
-            if(*rx == '\n') {
-                while(*rx == '\n' || *rx == '\r') {
-                    *rx-- = 0;
-                }
-                debugout("{");
-                debugout(buffer);
-                debugout("}\r\n");
-                return true;
-            } else {
-                rx++;
-            }
+        if(modemline(line)) {
+            debugline("{", line, "}\r\n");
+            return true;
         }
     }
-    *rx = 0;
-    debugout("{");
-    debugout(buffer);
-    debugout("}!\r\n");
     return false;
 }
 
@@ -172,14 +378,14 @@ void Modem::pushURC(char c)
   }
 }
 
-void Modem::pushURC(const char* urc) {
-    int len = strlen(urc);
+void Modem::pushURC(const ModemLine &urc) {
+    int len = urc.size();
     if(len+1 > remainingURC()) {
         return;
     }
-    
+
     for(int i=0;i<len;i++) {
-        pushURC(urc[i]);
+        pushURC(urc.at(i));
     }
     pushURC('\n');
 }
@@ -217,20 +423,31 @@ int Modem::nextSlotURC(int slot)
     return (uint32_t)(slot + 1) % URC_BUFFER_SIZE;
 }
 
-bool Modem::findlineURC(char *buffer) {
-    char *rx = buffer;
+//a queued line longer than the buffer is cut short and counted, the rest
+//of it is still drained
+bool Modem::findlineURC(char *buffer, uint32_t size) {
+    uint32_t len = 0;
+    bool truncated = false;
     while(availableURC()) {
-        *rx = popURC();
-        if(*rx == '\n') {
-            while(*rx == '\n' || *rx == '\r') {
-                *rx-- = 0;
+        char c = popURC();
+        if(c == '\n') {
+            while(len && buffer[len-1] == '\r') {
+                len--;
+            }
+            buffer[len] = 0;
+            if(truncated) {
+                urc_truncated++;
+                debugout("!URC truncated\r\n");
             }
             return true;
+        }
+        if(len < size-1) {
+            buffer[len++] = c;
         } else {
-            rx++;
+            truncated = true;
         }
     }
-    *rx = 0;
+    buffer[len] = 0;
     return false;
 }
 
@@ -252,62 +469,62 @@ void Modem::modemwrite(const char* cmd, cmd_flags flags) {
 }
 
 void Modem::checkURC() {
-    if(async_state == MODEM_BUSY) {
-        modem_result r = processResponse(10, cmdbuffer);
-        if(r == MODEM_TIMEOUT) {
-            if(msTick() - async_start >= async_timeout) {
-                async_state = MODEM_TIMEOUT;
-            }
-        } else {
-            async_state = r;
-        }
-        return;
-    }
+    if(directlink) return;
+    processQueue();
 
     while(availableURC()) {
-        if(findlineURC(okbuffer)) {
+        if(findlineURC(urcline, sizeof(urcline))) {
             if(receiver) {
-                receiver->onURC(okbuffer);
+                receiver->onURC(urcline);
             }
         }
     }
 
+    if(queue_count) return;
+
+    ModemLine line;
     while(modemavailable()) {
-        uint32_t startMillis = msTick();
-        if(findline(okbuffer, 100, startMillis)) {
-            if(okbuffer[0] == '+') {
-                debugout("!URC: '");
-                debugout(okbuffer);
-                debugout("'\r\n");
-                if(receiver) {
-                    receiver->onURC(okbuffer);
-                }
+        if(!modemline(line)) {
+            expireFragment();
+            return;
+        }
+        fragment_size = 0;
+        debugline("{", line, "}\r\n");
+        bool urc = (line.at(0) == '+');
+        if(urc) {
+            debugline("!URC: '", line, "'\r\n");
+            if(line.size() >= sizeof(urcline)) {
+                urc_truncated++;
+                debugout("!URC truncated\r\n");
             }
+            line.copy(urcline, sizeof(urcline));
+        }
+        modemskip(line.consumed);
+        if(urc && receiver) {
+            receiver->onURC(urcline);
         }
     }
 }
 
-int Modem::strncmpci(const char* str1, const char* str2, size_t num) {
-    for(int i=0; i<num; i++) {
-        char c1 = str1[i];
-        char c2 = str2[i];
-        if(c1 >= 'a' && c1 <= 'z') c1 -= 32;
-        if(c2 >= 'a' && c2 <= 'z') c2 -= 32;
-        if(c1 == c2) {
-            if(c1 == 0)
-                return 0;
-        } else {
-            return c1 - c2;
-        }
+//a partial line is left buffered while more of it arrives, once it stops
+//growing it is dropped rather than left to prefix the next response
+void Modem::expireFragment() {
+    int size = modemavailable();
+    if(size != fragment_size) {
+        fragment_size = size;
+        fragment_start = msTick();
+    } else if(msTick() - fragment_start >= MODEM_FRAGMENT_TIMEOUT) {
+        debugout("!DROP ");
+        debugout(size);
+        debugout("\r\n");
+        modemskip(size);
+        fragment_size = 0;
     }
-    return 0;
 }
 
-bool Modem::commandResponseMatch(const char* cmd, const char* response, int num) {
-    if(strncmpci(cmd, response, num) == 0) {
-        if(response[num] == ':' && response[num+1] == ' ') {
-            return true;
-        }
+bool Modem::commandResponseMatch(const char* cmd, const ModemLine &response) {
+    if(response.startsWith(cmd, 0, true)) {
+        return response.startsWith(": ", strlen(cmd));
     }
     return false;
 }
@@ -316,41 +533,52 @@ uint32_t Modem::numResponses() {
     return numresponses;
 }
 
+//returns MODEM_BUSY while the command is still waiting on its final result,
+//only lines that are kept get copied out of the receive buffer
+modem_result Modem::processLine(const ModemLine &line, const char* cmd, int minResponses) {
+    if(line.size() == 0) {
+        return MODEM_BUSY;
+    } else if(line.equals("ERROR")) {
+        return MODEM_ERROR;
+    } else if(line.startsWith("+CME ERROR:")) {
+        line.copy(respbuffer, sizeof(respbuffer));
+        return MODEM_ERROR;
+    } else if(line.startsWith("+CMS ERROR:")) {
+        line.copy(respbuffer, sizeof(respbuffer));
+        return MODEM_ERROR;
+    } else if(line.equals("OK") && numresponses >= minResponses) {
+        timeout_count = 0;
+        return MODEM_OK;
+    } else if(line.at(0) == '+') {
+        timeout_count = 0;
+        if(commandResponseMatch(cmd, line)) {
+            numresponses++;
+            line.copy(respbuffer, sizeof(respbuffer));
+        } else {
+            debugline(">URC: '", line, "'\r\n");
+            pushURC(line);
+        }
+    } else if(line.startsWith("AT") && line.startsWith(cmd, 2)) {
+        debugline(">ECHO: '", line, "'\r\n");
+    } else {
+        line.copy(respbuffer, sizeof(respbuffer));
+    }
+    return MODEM_BUSY;
+}
+
 modem_result Modem::processResponse(uint32_t timeout, const char* cmd, int minResponses) {
     uint32_t startMillis = msTick();
     numresponses = 0;
-    while(findline(okbuffer, timeout, startMillis)) {
-        if(okbuffer[0] == 0) {
-            continue;
-        } else if(strcmp(okbuffer, "ERROR") == 0) {
-            return MODEM_ERROR;
-        } else if(strncmp(okbuffer, "+CME ERROR:", 11) == 0) {
-            strcpy(respbuffer, okbuffer);
-            return MODEM_ERROR;
-        } else if(strncmp(okbuffer, "+CMS ERROR:", 11) == 0) {
-            strcpy(respbuffer, okbuffer);
-            return MODEM_ERROR;
-        } else if(strcmp(okbuffer, "OK") == 0 && numresponses >= minResponses) {
-            timeout_count = 0;
-            return MODEM_OK;
-        } else if(okbuffer[0] == '+') {
-            timeout_count = 0;
-            if(commandResponseMatch(cmd, okbuffer, strlen(cmd))) {
-                numresponses++;
-                strcpy(respbuffer, okbuffer);
-            } else {
-                debugout(">URC: '");
-                debugout(okbuffer);
-                debugout("'\r\n");
-                pushURC(okbuffer);
-            }
+    ModemLine line;
+    while(findline(line, timeout, startMillis)) {
+        modem_result r = processLine(line, cmd, minResponses);
+        bool plus = (line.at(0) == '+');
+        modemskip(line.consumed);
+        if(r != MODEM_BUSY) {
+            return r;
+        }
+        if(plus) {
             startMillis = msTick();
-        } else if(strncmp(okbuffer, "AT", 2) == 0 && strncmp(&okbuffer[2], cmd, strlen(cmd)) == 0) {
-            debugout(">ECHO: '");
-            debugout(okbuffer);
-            debugout("'\r\n");
-        } else {
-            strcpy(respbuffer, okbuffer);
         }
     }
     timeout_count++;
@@ -358,8 +586,7 @@ modem_result Modem::processResponse(uint32_t timeout, const char* cmd, int minRe
 }
 
 modem_result Modem::command(const char* cmd, const char* expected, uint32_t timeout, uint32_t retries, bool query) {
-    checkURC();
-    if(async_state == MODEM_BUSY) return MODEM_BUSY;
+    if(!waitQueue(timeout)) return MODEM_BUSY;
     modem_result r = MODEM_TIMEOUT;
     do {
         respbuffer[0] = 0;
@@ -384,27 +611,134 @@ modem_result Modem::command(const char* cmd, uint32_t timeout, uint32_t retries,
     return command(cmd, NULL, timeout, retries, query);
 }
 
-modem_result Modem::asyncStatus() {
-    return async_state;
+uint32_t Modem::queued() {
+    return queue_count;
 }
 
-modem_result Modem::asyncSet(const char* cmd, const char* value, uint32_t timeout) {
+//a blocking command waits for short queued commands to drain, but gives up
+//at once behind one that could outlast its own timeout
+bool Modem::waitQueue(uint32_t timeout) {
     checkURC();
-    if(async_state == MODEM_BUSY) return MODEM_BUSY;
-    respbuffer[0] = 0;
-    strcpy(cmdbuffer, cmd);
-    modemwrite(cmd, CMD_STARTAT);
-    modemwrite("=");
-    modemwrite(value, CMD_END);
-    async_state = MODEM_BUSY;
-    async_timeout = timeout;
-    async_start = msTick();
+    uint32_t startMillis = msTick();
+    while(queue_count && !directlink) {
+        for(uint32_t i=0; i<queue_count; i++) {
+            if(queue[(queue_head + i) % MODEM_QUEUE_SIZE].timeout > timeout) {
+                return false;
+            }
+        }
+        if(queue_running || msTick() - startMillis >= timeout) {
+            return false;
+        }
+        checkURC();
+    }
+    return !directlink;
+}
+
+void Modem::clearQueue() {
+    queue_head = 0;
+    queue_count = 0;
+    queue_sent = false;
+}
+
+modem_result Modem::enqueue(const char* cmd, const char* value, const char* expected, cmd_flags flags,
+                            uint32_t timeout, modem_callback callback, void* context) {
+    if(queue_count == MODEM_QUEUE_SIZE) return MODEM_BUSY;
+    if(strlen(cmd) >= MODEM_QUEUE_CMD_SIZE) return MODEM_ERROR;
+    if(value && strlen(value) >= MODEM_QUEUE_VALUE_SIZE) return MODEM_ERROR;
+
+    queued_command &q = queue[(queue_head + queue_count) % MODEM_QUEUE_SIZE];
+    strcpy(q.cmd, cmd);
+    q.hasvalue = (value != NULL);
+    if(value) {
+        strcpy(q.value, value);
+    }
+    q.expected = expected;
+    q.flags = flags;
+    q.timeout = timeout;
+    q.callback = callback;
+    q.context = context;
+    queue_count++;
+
+    processQueue();
     return MODEM_OK;
 }
 
+modem_result Modem::queueCommand(const char* cmd, uint32_t timeout, modem_callback callback, void* context) {
+    return enqueue(cmd, NULL, NULL, CMD_FULL, timeout, callback, context);
+}
+
+modem_result Modem::queueQuery(const char* cmd, uint32_t timeout, modem_callback callback, void* context) {
+    return enqueue(cmd, NULL, NULL, CMD_FULL_QUERY, timeout, callback, context);
+}
+
+modem_result Modem::queueSet(const char* cmd, const char* value, uint32_t timeout, modem_callback callback, void* context) {
+    return enqueue(cmd, value, NULL, CMD_STARTAT, timeout, callback, context);
+}
+
+modem_result Modem::queueSet(const char* cmd, const char* value, const char* expected, uint32_t timeout,
+                             modem_callback callback, void* context) {
+    return enqueue(cmd, value, expected, CMD_STARTAT, timeout, callback, context);
+}
+
+//drives the queue without blocking: sends the head command once, consumes
+//whatever lines have arrived, and completes it on a final result or timeout.
+//the modem runs one command at a time, so the next queued command goes out
+//as soon as the previous one completes.
+void Modem::processQueue() {
+    if(queue_running) return; //a callback queueing more, the loop below sends it
+    queue_running = true;
+    while(queue_count) {
+        queued_command &q = queue[queue_head];
+        if(!queue_sent) {
+            respbuffer[0] = 0;
+            numresponses = 0;
+            modemwrite(q.cmd, q.flags);
+            if(q.hasvalue) {
+                modemwrite("=");
+                modemwrite(q.value, CMD_END);
+            }
+            queue_sent = true;
+            queue_start = msTick();
+        }
+
+        modem_result r = MODEM_BUSY;
+        ModemLine line;
+        while(r == MODEM_BUSY && modemline(line)) {
+            debugline("{", line, "}\r\n");
+            r = processLine(line, q.cmd, 0);
+            if(line.at(0) == '+') {
+                queue_start = msTick();
+            }
+            modemskip(line.consumed);
+        }
+
+        if(r == MODEM_BUSY) {
+            if(msTick() - queue_start < q.timeout) {
+                break;
+            }
+            timeout_count++;
+            r = MODEM_TIMEOUT;
+        }
+
+        if(r == MODEM_OK && q.expected && strcmp(q.expected, respbuffer) != 0) {
+            r = MODEM_NO_MATCH;
+        }
+
+        modem_callback callback = q.callback;
+        void* context = q.context;
+        queue_head = (queue_head + 1) % MODEM_QUEUE_SIZE;
+        queue_count--;
+        queue_sent = false;
+
+        if(callback) {
+            callback(r, respbuffer, context);
+        }
+    }
+    queue_running = false;
+}
+
 modem_result Modem::set(const char* cmd, const char* value, const char* expected, uint32_t timeout, uint32_t retries) {
-    checkURC();
-    if(async_state == MODEM_BUSY) return MODEM_BUSY;
+    if(!waitQueue(timeout)) return MODEM_BUSY;
     modem_result r = MODEM_TIMEOUT;
     do {
         respbuffer[0] = 0;
@@ -449,8 +783,7 @@ void Modem::dataWrite(uint8_t b) {
 }
 
 void Modem::dataWrite(const uint8_t* content, uint32_t length) {
-    for(uint32_t i=0; i<length; i++)
-        modemout(content[i]);
+    modemout(content, length);
 }
 
 void Modem::rawRead(int length, void* buffer) {
@@ -472,6 +805,68 @@ void Modem::rawRead(int length, void* buffer) {
     }
 }
 
+//copies length payload bytes straight out of the receive buffer
+int Modem::dataRead(void* buffer, int length, uint32_t timeout) {
+    uint8_t* pbuffer = (uint8_t*)buffer;
+    int read = 0;
+    uint32_t startMillis = msTick();
+    do {
+        read += modemreadblock(&pbuffer[read], length - read);
+    }while(read < length && msTick() - startMillis < timeout);
+    return read;
+}
+
+//what the modem sends when it leaves direct link because the remote side
+//closed the socket
+static const char LINK_END[] = "\r\nDISCONNECT\r\n";
+#define LINK_END_LEN (sizeof(LINK_END)-1)
+
+//how many of the next limit bytes in direct link are payload. Payload stops
+//at DISCONNECT, and once it is next in line it is skipped and AT parsing
+//resumes. A partial DISCONNECT at the end is held back until it completes
+//or stops growing for MODEM_FRAGMENT_TIMEOUT.
+int Modem::linkAvailable(uint32_t limit) {
+    if(!directlink) return 0;
+    ModemLine line;
+    if(!modemhead(line)) return 0;
+    uint32_t size = line.size();
+    for(uint32_t i=0; i<size && i<limit; i++) {
+        if(line.at(i) != '\r') continue;
+        uint32_t n = 1;
+        while(n < LINK_END_LEN && i+n < size && line.at(i+n) == LINK_END[n]) {
+            n++;
+        }
+        if(n == LINK_END_LEN) {
+            if(i == 0) {
+                modemskip(LINK_END_LEN);
+                directlink = false;
+                debugout("DISCONNECT\r\n");
+            }
+            return i;
+        }
+        if(i+n == size) {
+            if(size != fragment_size) {
+                fragment_size = size;
+                fragment_start = msTick();
+            } else if(msTick() - fragment_start >= MODEM_FRAGMENT_TIMEOUT) {
+                continue;
+            }
+            return i;
+        }
+    }
+    return size < limit ? size : limit;
+}
+
+//direct link payload that has already arrived, up to a DISCONNECT
+int Modem::linkRead(void* buffer, int length) {
+    int count = linkAvailable(length);
+    if(count > 0) {
+        count = modemreadblock((uint8_t*)buffer, count);
+    }
+    linkAvailable(1); //ends the link if DISCONNECT is now next
+    return count;
+}
+
 uint8_t Modem::convertHex(char hex) {
     uint8_t x = 0;
     if(hex >= '0' && hex <= '9') {
@@ -32,6 +32,66 @@ typedef enum {
     MODEM_OK = 0,
 }modem_result;
 
+#ifndef MODEM_QUEUE_SIZE
+#define MODEM_QUEUE_SIZE 12
+#endif
+
+//an unterminated line that gets no new bytes for this long is dropped
+#ifndef MODEM_FRAGMENT_TIMEOUT
+#define MODEM_FRAGMENT_TIMEOUT 100
+#endif
+
+#define MODEM_QUEUE_CMD_SIZE 16
+#define MODEM_QUEUE_VALUE_SIZE 48
+
+//called once a queued command completes, after it has left the queue
+typedef void (*modem_callback)(modem_result result, const char* response, void* context);
+
+//a received line viewed in place in the modem's receive buffer; the text
+//is split in two when it wraps around the end of the buffer, and carries
+//no terminator. only valid until the receive buffer is consumed.
+class ModemLine {
+public:
+    const char* data[2];
+    uint32_t length[2];
+    uint32_t consumed; //bytes to skip, including the line terminator
+
+    uint32_t size() const {return length[0] + length[1];}
+    char at(uint32_t i) const {
+        if(i < length[0]) return data[0][i];
+        if(i < size()) return data[1][i-length[0]];
+        return 0;
+    }
+    bool equals(const char* str) const;
+    bool startsWith(const char* str, uint32_t offset=0, bool nocase=false) const;
+    uint32_t copy(char* dst, uint32_t size) const;
+};
+
+//key for a URC prefix (the text before ':'), usable as a compile time
+//constant so URC routes can be matched without string compares
+constexpr uint32_t urcKey(const char* urc, uint32_t hash=2166136261u) {
+    return (*urc == 0 || *urc == ':') ? hash : urcKey(urc+1, (hash ^ (uint8_t)*urc) * 16777619u);
+}
+
+#define URC_MAX_ARGS 8
+
+//the comma separated fields following a URC prefix, split in place;
+//quoted fields are stored without their quotes
+class URCArgs {
+public:
+    URCArgs(const char* urc);
+    int count() const {return num;}
+    int toInt(int i) const;
+    bool equals(int i, const char* str) const;
+    int copy(int i, char* dst, int size) const;
+    const char* field(int i) const {return i < num ? fields[i] : "";}
+
+protected:
+    const char* fields[URC_MAX_ARGS];
+    uint16_t lengths[URC_MAX_ARGS];
+    int num;
+};
+
 class URCReceiver {
 public:
     virtual void onURC(const char* urc)=0;
@@ -44,8 +104,12 @@ public:
     modem_result command(const char* cmd, const char* expected, uint32_t timeout=1000, uint32_t retries=0, bool query=false);
     modem_result set(const char* cmd, const char* value, uint32_t timeout=1000, uint32_t retries=0);
     modem_result set(const char* cmd, const char* value, const char* expected, uint32_t timeout=1000, uint32_t retries=0);
-    modem_result asyncSet(const char* cmd, const char* value, uint32_t timeout=1000);
-    modem_result asyncStatus();
+    modem_result queueCommand(const char* cmd, uint32_t timeout=1000, modem_callback callback=NULL, void* context=NULL);
+    modem_result queueQuery(const char* cmd, uint32_t timeout=1000, modem_callback callback=NULL, void* context=NULL);
+    modem_result queueSet(const char* cmd, const char* value, uint32_t timeout=1000, modem_callback callback=NULL, void* context=NULL);
+    modem_result queueSet(const char* cmd, const char* value, const char* expected, uint32_t timeout=1000, modem_callback callback=NULL, void* context=NULL);
+    uint32_t queued();
+    void clearQueue();
     void startSet(const char* cmd);
     void appendSet(int value);
     void appendSet(const char* value);
@@ -54,6 +118,12 @@ public:
     modem_result completeSet(uint32_t timeout=1000, uint32_t retries=0);
     modem_result completeSet(const char* expected, uint32_t timeout=1000, uint32_t retries=0);
     modem_result intermediateSet(char expected, uint32_t timeout=1000, uint32_t retries=0);
+    modem_result headerSet(uint32_t timeout=1000, int quotes=1);
+    modem_result sendSet();
+    modem_result waitHeader(uint32_t timeout=1000, int quotes=1);
+    modem_result connectSet(uint32_t timeout=1000);
+    modem_result disconnect(uint32_t timeout=1000);
+    bool suspended() {return directlink;}
     modem_result waitSetComplete(uint32_t timeout=1000, uint32_t retries=0);
     modem_result waitSetComplete(const char* expected, uint32_t timeout=1000, uint32_t retries=0);
     modem_result query(const char* cmd, uint32_t timeout=1000, uint32_t retries=0) {
@@ -63,6 +133,7 @@ public:
         return command(cmd, expected, timeout, retries, true);
     }
     uint32_t timeoutCount();
+    uint32_t truncatedURCs();
     const char* lastResponse();
     uint32_t numResponses();
     void checkURC();
@@ -71,6 +142,9 @@ public:
     void dataWrite(const uint8_t* content, uint32_t length);
     void dataWrite(uint8_t b);
     void rawRead(int length, void* buffer);
+    int dataRead(void* buffer, int length, uint32_t timeout=1000);
+    int linkAvailable(uint32_t limit);
+    int linkRead(void* buffer, int length);
     virtual uint32_t msTick()=0;
 
     static uint8_t convertHex(char hex);
@@ -78,6 +152,7 @@ public:
 
 protected:
     #define URC_BUFFER_SIZE 256
+    #define URC_LINE_SIZE 128
     typedef enum {
         CMD_NONE  = 0x00,
         CMD_START = 0x01,
@@ -90,40 +165,71 @@ protected:
         CMD_FULL_QUERY = 0x0F,
     }cmd_flags;
 
+    typedef struct {
+        char cmd[MODEM_QUEUE_CMD_SIZE];
+        char value[MODEM_QUEUE_VALUE_SIZE];
+        const char* expected; //must outlive the queued command
+        cmd_flags flags;
+        bool hasvalue;
+        uint32_t timeout;
+        modem_callback callback;
+        void* context;
+    }queued_command;
+
     virtual void modemout(char c)=0;
     virtual void modemout(const char* str)=0;
     virtual void modemout(uint8_t b)=0;
+    virtual void modemout(const uint8_t* data, uint32_t length)=0;
     virtual void debugout(const char* str){}
     virtual void debugout(char c){}
     virtual void debugout(int i){}
+    virtual void debugout(const char* str, uint32_t len){}
     virtual int modemavailable()=0;
     virtual uint8_t modemread()=0;
     virtual uint8_t modempeek()=0;
+    virtual int modemreadblock(uint8_t* buffer, int length)=0;
+    virtual bool modemline(ModemLine &line)=0;
+    virtual bool modemhead(ModemLine &line)=0;
+    virtual void modemskip(uint32_t count)=0;
     void modemwrite(const char* cmd, cmd_flags flags = CMD_NONE);
-    bool findline(char *buffer, uint32_t timeout, uint32_t startMillis);
+    void debugline(const char* prefix, const ModemLine &line, const char* suffix);
+    bool findline(ModemLine &line, uint32_t timeout, uint32_t startMillis);
+    bool takeHeader(const ModemLine &line, int quotes);
+    modem_result processLine(const ModemLine &line, const char* cmd, int minResponses);
     modem_result processResponse(uint32_t timeout, const char* cmd, int minResponse=0);
-    int strncmpci(const char* str1, const char* str2, size_t num);
-    bool commandResponseMatch(const char* cmd, const char* response, int num);
+    modem_result enqueue(const char* cmd, const char* value, const char* expected, cmd_flags flags,
+                         uint32_t timeout, modem_callback callback, void* context);
+    void processQueue();
+    bool waitQueue(uint32_t timeout);
+    bool commandResponseMatch(const char* cmd, const ModemLine &response);
 
     void pushURC(char c);
-    void pushURC(const char* urc);
+    void pushURC(const ModemLine &urc);
     int popURC();
     int availableURC();
     int remainingURC();
     int nextSlotURC(int slot);
-    bool findlineURC(char *buffer);
+    bool findlineURC(char *buffer, uint32_t size);
+    void expireFragment();
 
     URCReceiver *receiver;
     char cmdbuffer[32];
     char valbuffer[48];
     char respbuffer[512];
-    char okbuffer[512];
+    char urcline[URC_LINE_SIZE];
     char *valoffset;
+    bool directlink;
     uint32_t numresponses;
-    modem_result async_state;
-    uint32_t async_start;
-    uint32_t async_timeout;
+    queued_command queue[MODEM_QUEUE_SIZE];
+    uint32_t queue_head;
+    uint32_t queue_count;
+    bool queue_sent;
+    bool queue_running;       //processQueue is on the stack, callbacks only queue
+    uint32_t queue_start;
     uint32_t timeout_count;
+    uint32_t urc_truncated;
+    int fragment_size;        //bytes of the unterminated line last seen
+    uint32_t fragment_start;  //msTick when it last grew
     char urc_buffer[URC_BUFFER_SIZE];
     int urc_write;
     int urc_read;
@@ -20,11 +20,13 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include "UBlox.h"
-#include <cstdio>
+#include "../modem/ATScan.h"
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
 
-#define MAX_READ_LEN 32
+#define MAX_READ_LEN 1024 //binary +USORD limit
+#define MAX_WRITE_LEN 1024 //binary +USOWR limit
 
 void UBlox::init(NetworkEventHandler &handler, Modem &m) {
     Network::init(handler);
@@ -32,24 +34,41 @@ void UBlox::init(NetworkEventHandler &handler, Modem &m) {
     //connectStatus = UBLOX_CONN_ERR_OFF;
     state = UBLOX_STATE_INIT;
     networkTimeValid = false;
+    direct_socket = -1;
+    socket_id = 0;
+    prefetch_next = 0;
+    config_next = 0;
+    refresh_next = -1;
+    for(int i=0; i<UBLOX_SOCKET_RX_BUFFERS; i++) {
+        rx_pool_used[i] = false;
+    }
+    for(int i=0; i<UBLOX_SOCKET_WR_BUFFERS; i++) {
+        tx_pool_used[i] = false;
+    }
     for(int i=0; i<UBLOX_SOCKET_COUNT; i++) {
-        sockets[i].bytes_available = 0;
-        sockets[i].type = SOCKET_TYPE_NONE;
-        sockets[i].id = 0;
+        sockets[i].rx_buffer = -1;
+        sockets[i].tx_buffer = -1;
+        _reset(i);
     }
 }
 
 void UBlox::powerUp() {
     if(state == UBLOX_STATE_OFF) {
         eventHandler->onPowerUp();
+        modem->clearQueue();
         state = UBLOX_STATE_INIT;
         toggleReset();
     }
 }
 
 void UBlox::powerDown(bool soft) {
+    if(direct_socket != -1) {
+        exitDirectLink();
+    }
     state = UBLOX_STATE_OFF;
     networkTimeValid = false;
+    refresh_next = -1;
+    modem->clearQueue();
     if(soft) {
         if(modem->command("", 200) == MODEM_OK) {
             if(modem->command("+CPWROFF", 40000) == MODEM_OK) {
@@ -69,6 +88,7 @@ void UBlox::state_init() {
         modem->command("E0"); //echo off
         modem->set("+CMEE", "2"); //set verbose error codes
         loadModel();
+        config_next = 0;
         state = UBLOX_STATE_CHECK_SIM;
     } else {
         if(retries-- <= 0) {
@@ -78,43 +98,117 @@ void UBlox::state_init() {
     }
 }
 
+//queued once the SIM is ready, the last one completes the configuration
+const UBlox::sim_setting UBlox::sim_settings[] = {
+    {"+CTZU",   "1", 1000}, //time/zone sync
+    {"+CTZR",   "1", 1000}, //time/zone URC
+    {"+CPMS",   "\"ME\",\"ME\",\"ME\"", 1000},
+    {"+CMGF",   "0", 1000}, //SMS PDU format
+    {"+CNMI",   "2,1", 1000}, //SMS New Message Indication
+    {"+UMWI",   "0", 1000}, //no message waiting URCs
+    {"+UPSD",   "0,1,\"hologram\"", 3000},
+    {"+UPSD",   "0,7,\"0.0.0.0\"", 3000},
+    {"+UDCONF", "1,0", 1000}, //binary socket reads
+    {"+CREG",   "2", 1000},
+    {"+CGREG",  "2", 1000},
+    {NULL, NULL, 0}
+};
+
 void UBlox::state_check_sim() {
     static int cpin_count = 50;
-    if(modem->query("+CPIN", "+CPIN: READY") == MODEM_OK) {
-        state = UBLOX_STATE_UNREGISTERED;
-        cpin_count = 50;
-        modem->set("+CTZU", "1"); //time/zone sync
-        modem->set("+CTZR", "1"); //time/zone URC
-        modem->set("+CPMS", "\"ME\",\"ME\",\"ME\"");
-        modem->set("+CMGF", "0"); //SMS PDU format
-        modem->set("+CNMI", "2,1"); //SMS New Message Indication
-        modem->set("+UPSD", "0,1,\"hologram\"", 3000);
-        modem->set("+UPSD", "0,7,\"0.0.0.0\"", 3000);
-        modem->set("+CREG", "2");
-        modem->set("+CGREG", "2");
-
-        for(int i=0; i<UBLOX_SOCKET_COUNT; i++) {
-            //get socket states
-            switch(_socketState(i)) {
-            case 0: //CLOSED
-                break;
-            case 1: //LISTEN
-                sockets[i].type = SOCKET_TYPE_LISTEN;
-                break;
-            default:
-                sockets[i].type = SOCKET_TYPE_ACTIVE;
-                _available(i); //load bytes_available
-                break;
+    if(modem->queued()) return; //configuration still running
+    if(config_next == 0) {
+        if(modem->query("+CPIN", "+CPIN: READY") != MODEM_OK) {
+            if(--cpin_count <= 0) {
+                if((state == UBLOX_STATE_CHECK_SIM) &&
+                   (strcmp("+CME ERROR: SIM not inserted", modem->lastResponse()) == 0)) {
+                    state = UBLOX_STATE_NO_SIM;
+                    //notify?
+                }
             }
+            return;
         }
-        getNumSMS();
+        cpin_count = 50;
+    }
+    //a full queue stops here, the next poll goes on from config_next
+    while(sim_settings[config_next].cmd) {
+        const sim_setting &s = sim_settings[config_next];
+        bool last = sim_settings[config_next+1].cmd == NULL;
+        if(modem->queueSet(s.cmd, s.value, s.timeout, last ? onSimConfigured : NULL, this) != MODEM_OK)
+            return;
+        config_next++;
     }
-    else if(--cpin_count <= 0) {
-        if((state == UBLOX_STATE_CHECK_SIM) &&
-           (strcmp("+CME ERROR: SIM not inserted", modem->lastResponse()) == 0)) {
-            state = UBLOX_STATE_NO_SIM;
-            //notify?
+}
+
+//runs once the queued SIM configuration has drained. Callbacks run inside
+//the queue, so the socket and SMS state is refreshed by queueing more.
+void UBlox::onSimConfigured(modem_result result, const char* response, void* context) {
+    UBlox *ublox = (UBlox*)context;
+    if(ublox->state != UBLOX_STATE_CHECK_SIM && ublox->state != UBLOX_STATE_NO_SIM) return;
+    ublox->state = UBLOX_STATE_UNREGISTERED;
+    ublox->config_next = 0;
+    ublox->refresh_next = 0;
+    ublox->queueRefresh();
+}
+
+//queues the socket states then the SMS count. A full queue stops here and
+//pollEvents goes on from refresh_next.
+void UBlox::queueRefresh() {
+    char value[8];
+    while(refresh_next != -1) {
+        modem_result r;
+        if(refresh_next < UBLOX_SOCKET_COUNT) {
+            sprintf(value, "%d,10", refresh_next);
+            r = modem->queueSet("+USOCTL", value, 1000, onSocketState, this);
+        } else {
+            r = modem->queueQuery("+CPMS", 1000, onSMSCount, this);
         }
+        if(r != MODEM_OK) return;
+        refresh_next = (refresh_next < UBLOX_SOCKET_COUNT) ? refresh_next + 1 : -1;
+    }
+}
+
+void UBlox::onSocketState(modem_result result, const char* response, void* context) {
+    UBlox *ublox = (UBlox*)context;
+    int socket, paramid, sockstate;
+    if(result != MODEM_OK || atscan(response, "+USOCTL: ", socket, paramid, sockstate) != 3) return;
+    if(socket < 0 || socket >= UBLOX_SOCKET_COUNT) return;
+
+    switch(sockstate) {
+    case 0: //CLOSED
+        break;
+    case 1: //LISTEN
+        ublox->sockets[socket].type = SOCKET_TYPE_LISTEN;
+        break;
+    default:
+        ublox->sockets[socket].type = SOCKET_TYPE_ACTIVE;
+        char value[8];
+        sprintf(value, "%d,0", socket);
+        ublox->modem->queueSet("+USORD", value, 1000, onSocketAvailable, ublox);
+        break;
+    }
+}
+
+void UBlox::onSocketAvailable(modem_result result, const char* response, void* context) {
+    UBlox *ublox = (UBlox*)context;
+    int socket, avail;
+    if(result != MODEM_OK || atscan(response, "+USORD: ", socket, avail) != 2) return;
+    if(socket < 0 || socket >= UBLOX_SOCKET_COUNT) return;
+    ublox->sockets[socket].bytes_available = avail;
+}
+
+void UBlox::onSMSCount(modem_result result, const char* response, void* context) {
+    UBlox *ublox = (UBlox*)context;
+    int inuse, slots;
+    if(result != MODEM_OK || atscan(response, "+CPMS: \"ME\",", inuse, slots) != 2) return;
+    ublox->num_sms = inuse;
+    ublox->slots_sms = slots;
+}
+
+void UBlox::onConnectComplete(modem_result result, const char* response, void* context) {
+    UBlox *ublox = (UBlox*)context;
+    if(ublox->state == UBLOX_STATE_CONNECTING) {
+        ublox->state = UBLOX_STATE_REGISTERED;
     }
 }
 
@@ -123,19 +217,18 @@ void UBlox::state_unregistered() {
     bool greg = false;
     int n = 0;
     int stat = 0;
+    //+CREG: [<n>,]<stat>[,<lac>,<ci>]
     if(modem->query("+CREG") == MODEM_OK) {
-        if(sscanf(modem->lastResponse(), "+CREG: %d,%d", &n, &stat) == 2) {
-            reg = (stat == 1) || (stat == 5);
-        } else if(sscanf(modem->lastResponse(), "+CREG: %d", &stat) == 1) {
-            reg = (stat == 1) || (stat == 5);
+        switch(atscan(modem->lastResponse(), "+CREG: ", n, stat)) {
+            case 1: stat = n; //fall through
+            case 2: reg = (stat == 1) || (stat == 5);
         }
     }
     if(!reg) {
         if(modem->query("+CGREG") == MODEM_OK) {
-            if(sscanf(modem->lastResponse(), "+CGREG: %d,%d", &n, &stat) == 2) {
-                greg = (stat == 1) || (stat == 5);
-            } else if(sscanf(modem->lastResponse(), "+CGREG: %d", &stat) == 1) {
-                greg = (stat == 1) || (stat == 5);
+            switch(atscan(modem->lastResponse(), "+CGREG: ", n, stat)) {
+                case 1: stat = n; //fall through
+                case 2: greg = (stat == 1) || (stat == 5);
             }
         }
     }
@@ -150,12 +243,22 @@ void UBlox::state_registered() {
         eventHandler->onNetworkEvent(UBLOX_EVENT_CONNECTED, NULL);
     } else {
         state = UBLOX_STATE_CONNECTING;
-        modem->asyncSet("+UPSDA", "0,3", 180000);
+        if(modem->queueSet("+UPSDA", "0,3", 180000, onConnectComplete, this) != MODEM_OK) {
+            state = UBLOX_STATE_REGISTERED;
+        }
     }
 }
 
 void UBlox::pollEvents() {
+    if(direct_socket != -1) {
+        //AT parsing is suspended until the link ends
+        modem->linkAvailable(1);
+        if(!_linkClosed()) return;
+    }
     modem->checkURC();
+    if(refresh_next != -1) {
+        queueRefresh();
+    }
     switch(state) {
         case UBLOX_STATE_INIT:
             state_init();
@@ -171,17 +274,15 @@ void UBlox::pollEvents() {
             state_registered();
             break;
         case UBLOX_STATE_CONNECTING:
-            if(modem->asyncStatus() != MODEM_BUSY) {
-                state = UBLOX_STATE_REGISTERED;
-                state_registered();
-            }
             break;
         case UBLOX_STATE_CONNECTED:
             modem->command("", 100);
+            prefetch();
+            flushAged();
             break;
     }
     if(isInitialized()) {
-        if(modem->timeoutCount() > 10 && modem->asyncStatus() != MODEM_BUSY) {
+        if(modem->timeoutCount() > 10 && modem->queued() == 0) {
             if(modem->command("", 100) != MODEM_OK) {
                 state = UBLOX_STATE_OFF;
                 powerUp();
@@ -245,7 +346,7 @@ int UBlox::getSignalStrength() {
     int rssi = 99;
     int qual = 0;
     if(isReady() && modem->command("+CSQ") == MODEM_OK) {
-        sscanf(modem->lastResponse(), "+CSQ: %d,%d", &rssi, &qual);
+        atscan(modem->lastResponse(), "+CSQ: ", rssi, qual);
     }
     return rssi;
 }
@@ -273,9 +374,9 @@ void UBlox::loadModel() {
 }
 
 const char* UBlox::getModel() {
-    if(model == NULL) {
+    if(model[0] == 0) {
         loadModel();
-        if(model == NULL)
+        if(model[0] == 0)
             return "-unknown";
     }
     return model;
@@ -307,6 +408,7 @@ uint8_t UBlox::convertField(const char* field) {
 bool UBlox::isNetworkTimeAvailable() {
     if(networkTimeValid) return true;
     if(isRegistered()) return true;
+    return false;
 }
 
 bool UBlox::getNetworkTime(timestamp_tz& ts) {
@@ -339,7 +441,7 @@ int UBlox::getNumSMS() {
     slots_sms = 0;
     if(isReady() && modem->query("+CPMS") == MODEM_OK) {
         int inuse, slots;
-        if(sscanf(modem->lastResponse(), "+CPMS: \"ME\",%d,%d", &inuse, &slots) == 2) {
+        if(atscan(modem->lastResponse(), "+CPMS: \"ME\",", inuse, slots) == 2) {
             num_sms = inuse;
             slots_sms = slots;
         }
@@ -443,14 +545,12 @@ void UBlox::convert7to8bit(char* dst, const char* src, int num_chars) {
     int offset = 0;
     int last = 0;
     int current = 0;
-    char bytebuf[3];
     bool inescape = false;
 
     while(num_chars--) {
         last = current;
         if(offset < 7) {
-            strncpy(bytebuf, src, 2);
-            sscanf(bytebuf, "%x", &current);
+            current = Modem::convertHex(src);
             src += 2;
         }
 
@@ -527,107 +627,153 @@ bool UBlox::parse_sms_pdu(const char* fullpdu, sms_event &parsed_sms) {
     return true;
 }
 
+#define URC_ROUTE(prefix, handler) {urcKey(prefix), prefix, &UBlox::handler}
+
+//add new URCs here, keyed on the text before the ':'
+const UBlox::urc_route UBlox::urc_routes[] = {
+    URC_ROUTE("+UUSORD",   urcSocketRead),
+    URC_ROUTE("+UUSORF",   urcDatagramRead),
+    URC_ROUTE("+UUSOCL",   urcSocketClosed),
+    URC_ROUTE("+UUSOLI",   urcSocketAccept),
+    URC_ROUTE("+CMTI",     urcSMSReceived),
+    URC_ROUTE("+UUPSDD",   urcPacketDisconnect),
+    URC_ROUTE("+CREG",     urcRegistration),
+    URC_ROUTE("+CGREG",    urcRegistration),
+    URC_ROUTE("+UUHTTPCR", urcHttpResult),
+    URC_ROUTE("+CTZV",     urcTimeZone),
+    URC_ROUTE("+UULOC",    urcLocation),
+    {0, NULL, NULL}
+};
+
 void UBlox::onURC(const char* urc) {
-    if(startswith(urc, "+UUSORD: ")) {
-        int sock, len;
-        if(sscanf(urc, "+UUSORD: %d,%d", &sock, &len) == 2) {
-            //TODO confirm socket state variables
-            sockets[sock].bytes_available += len;
-        }
-    } else if(startswith(urc, "+UUSOCL: ")) {
-        int sock;
-        if(sscanf(urc, "+UUSOCL: %d", &sock) == 1) {
-            sockets[sock].id = 0;
-            sockets[sock].type = SOCKET_TYPE_NONE;
-            //TODO: handle LISTEN vs ACTIVE?
-            sockets[sock].bytes_available = 0;
-        }
-    } else if(startswith(urc, "+CMTI: ")) {
-        int addr=0;
-        char mem[8];
-        if(sscanf(urc, "+CMTI: \"%[^\"]\",%d", mem, &addr) == 2) {
-            eventHandler->onNetworkEvent(UBLOX_EVENT_SMS_RECEIVED, &addr);
-        }
-    } else if(startswith(urc, "+UMWI: ")) {
-        //TODO startup messages
-    } else if(strcmp(urc, "+UUPSDD: 0") == 0) {
-        setRegistered(false);
-        for(int i=0; i<UBLOX_SOCKET_COUNT; i++) {
-            //any active sockets are closed?
-            //_close(socketnum) vs close(socket)
-        }
-        eventHandler->onNetworkEvent(UBLOX_EVENT_FORCED_DISCONNECT, NULL);
-    } else if(startswith(urc, "+CREG: ")) {
-        int stat = 0;
-        if(sscanf(urc, "+CREG: %d,", &stat) == 1) {
-            setRegistered((stat == 1) || (stat == 5));
+    uint32_t key = urcKey(urc);
+    for(const urc_route *route = urc_routes; route->prefix; route++) {
+        if(route->key == key && startswith(urc, route->prefix)) {
+            URCArgs args(urc);
+            (this->*(route->handler))(args);
+            return;
         }
-    } else if(startswith(urc, "+CGREG: ")) {
-        int stat = 0;
-        if(sscanf(urc, "+CGREG: %d,", &stat) == 1) {
-            setRegistered((stat == 1) || (stat == 5));
-        }
-    } else if(startswith(urc, "+UUHTTPCR: ")) {
-        int flag;
-        if(sscanf(urc, "+UUHTTPCR: 0,1,%d", &flag) == 1) {
-            httpGetFlag = flag;
-        }
-    } else if(startswith(urc, "+CTZV: ")) {
-        //TODO Timezone updated, ublox RTC set
-        eventHandler->onNetworkEvent(UBLOX_EVENT_NETWORK_TIME_UPDATE, NULL);
-    } else if(startswith(urc, "+UUSOLI: ")) {
-        //+UUSOLI: <socket>,<"ip_address">,<port>,<listening_socket>,<"local_ip_address">,<listenting_port>
-        int socketnum;
-        int server;
-        socket_accept_event event;
-        if(sscanf(urc, "+UUSOLI: %d,\"%[^\"]\",%d,%d,\"%[^\"]\",%d", &socketnum, event.remote.host, &event.remote.port, &server, event.local.host, &event.local.port) == 6) {
-            //new inbound socket
-            sockets[socketnum].bytes_available = 0;
-            sockets[socketnum].id = nextSocket();
-            sockets[socketnum].type = SOCKET_TYPE_ACTIVE;
+    }
+    debug("Unknown URC: ");
+    debugln(urc);
+}
+
+//+UUSORD: <socket>,<length>
+void UBlox::urcSocketRead(const URCArgs &args) {
+    if(args.count() != 2) return;
+    int sock = args.toInt(0);
+    if(sock < 0 || sock >= UBLOX_SOCKET_COUNT) return;
+    //TODO confirm socket state variables
+    sockets[sock].bytes_available += args.toInt(1);
+}
 
-            event.socket = sockets[socketnum].id;
-            event.listener = sockets[server].id;
+//+UUSORF: <socket>,<length>
+void UBlox::urcDatagramRead(const URCArgs &args) {
+    if(args.count() != 2) return;
+    int sock = args.toInt(0);
+    if(sock < 0 || sock >= UBLOX_SOCKET_COUNT) return;
+    sockets[sock].bytes_available += args.toInt(1);
+}
 
-            eventHandler->onNetworkEvent(UBLOX_EVENT_SOCKET_ACCEPT, &event);
-        }
-    } else if(startswith(urc, "+UULOC: ")) {
-        //+UULOC: 13/04/2011,09:54:51.000,45.6334520,13.0618620,49,1
-        location_event event;
-        char numbuf[16];
-        const char *pstr = &urc[8];
-
-        event.timestamp.tzquarter = 0;
-        event.timestamp.day = atoi(pstr);
-        pstr = strchr(pstr, '/') + 1;
-        event.timestamp.month = atoi(pstr);
-        pstr = strchr(pstr, '/') + 1;
-        uint32_t year = atoi(pstr);
-        event.timestamp.year = year >= 2000 ? (year-2000) : year;
-        pstr = strchr(pstr, ',') + 1;
-        event.timestamp.hour = atoi(pstr);
-        pstr = strchr(pstr, ':') + 1;
-        event.timestamp.minute = atoi(pstr);
-        pstr = strchr(pstr, ':') + 1;
-        event.timestamp.second = atoi(pstr);
-        pstr = strchr(pstr, ',') + 1;
-        char *pend = strchr(pstr, ',');
-        memcpy(event.lat, pstr, pend-pstr);
-        event.lat[pend-pstr] = 0;
-        pstr = pend+1;
-        pend = strchr(pstr, ',');
-        memcpy(event.lon, pstr, pend-pstr);
-        event.lon[pend-pstr] = 0;
-        pstr = pend+1;
-        event.altitude = atoi(pstr);
-        pstr = strchr(pstr, ',') + 1;
-        event.uncertainty = atoi(pstr);
-
-        eventHandler->onNetworkEvent(UBLOX_EVENT_LOCATION_UPDATE, &event);
-    } else {
-        debug("Unknown URC: ");
-        debugln(urc);
+//+UUSOCL: <socket>
+void UBlox::urcSocketClosed(const URCArgs &args) {
+    if(args.count() != 1) return;
+    int sock = args.toInt(0);
+    if(sock < 0 || sock >= UBLOX_SOCKET_COUNT) return;
+    //TODO: handle LISTEN vs ACTIVE?
+    _reset(sock);
+}
+
+//+UUSOLI: <socket>,<"ip_address">,<port>,<listening_socket>,<"local_ip_address">,<listenting_port>
+void UBlox::urcSocketAccept(const URCArgs &args) {
+    if(args.count() != 6) return;
+    int socketnum = args.toInt(0);
+    int server = args.toInt(3);
+    if(socketnum < 0 || socketnum >= UBLOX_SOCKET_COUNT) return;
+    if(server < 0 || server >= UBLOX_SOCKET_COUNT) return;
+
+    socket_accept_event event;
+    args.copy(1, event.remote.host, sizeof(event.remote.host));
+    event.remote.port = args.toInt(2);
+    args.copy(4, event.local.host, sizeof(event.local.host));
+    event.local.port = args.toInt(5);
+
+    //new inbound socket
+    _reset(socketnum);
+    sockets[socketnum].id = nextSocket();
+    sockets[socketnum].type = SOCKET_TYPE_ACTIVE;
+
+    event.socket = sockets[socketnum].id;
+    event.listener = sockets[server].id;
+
+    eventHandler->onNetworkEvent(UBLOX_EVENT_SOCKET_ACCEPT, &event);
+}
+
+//+CMTI: <"mem">,<index>
+void UBlox::urcSMSReceived(const URCArgs &args) {
+    if(args.count() != 2) return;
+    int addr = args.toInt(1);
+    eventHandler->onNetworkEvent(UBLOX_EVENT_SMS_RECEIVED, &addr);
+}
+
+//+UUPSDD: <profile>
+void UBlox::urcPacketDisconnect(const URCArgs &args) {
+    if(!args.equals(0, "0")) return;
+    setRegistered(false);
+    for(int i=0; i<UBLOX_SOCKET_COUNT; i++) {
+        //any active sockets are closed?
+        //_close(socketnum) vs close(socket)
     }
+    eventHandler->onNetworkEvent(UBLOX_EVENT_FORCED_DISCONNECT, NULL);
+}
+
+//+CREG: <stat>[,<lac>,<ci>] and +CGREG: <stat>[,<lac>,<ci>]
+void UBlox::urcRegistration(const URCArgs &args) {
+    if(args.count() < 1) return;
+    int stat = args.toInt(0);
+    setRegistered((stat == 1) || (stat == 5));
+}
+
+//+UUHTTPCR: <profile>,<command>,<result>
+void UBlox::urcHttpResult(const URCArgs &args) {
+    if(args.count() != 3) return;
+    if(args.toInt(0) == 0 && args.toInt(1) == 1) {
+        httpGetFlag = args.toInt(2);
+    }
+}
+
+void UBlox::urcTimeZone(const URCArgs &args) {
+    //TODO Timezone updated, ublox RTC set
+    eventHandler->onNetworkEvent(UBLOX_EVENT_NETWORK_TIME_UPDATE, NULL);
+}
+
+//+UULOC: 13/04/2011,09:54:51.000,45.6334520,13.0618620,49,1
+void UBlox::urcLocation(const URCArgs &args) {
+    if(args.count() < 6) return;
+    location_event event;
+
+    const char *pstr = args.field(0);
+    event.timestamp.tzquarter = 0;
+    event.timestamp.day = atoi(pstr);
+    pstr = strchr(pstr, '/') + 1;
+    event.timestamp.month = atoi(pstr);
+    pstr = strchr(pstr, '/') + 1;
+    uint32_t year = atoi(pstr);
+    event.timestamp.year = year >= 2000 ? (year-2000) : year;
+
+    pstr = args.field(1);
+    event.timestamp.hour = atoi(pstr);
+    pstr = strchr(pstr, ':') + 1;
+    event.timestamp.minute = atoi(pstr);
+    pstr = strchr(pstr, ':') + 1;
+    event.timestamp.second = atoi(pstr);
+
+    args.copy(2, event.lat, sizeof(event.lat));
+    args.copy(3, event.lon, sizeof(event.lon));
+    event.altitude = args.toInt(4);
+    event.uncertainty = args.toInt(5);
+
+    eventHandler->onNetworkEvent(UBLOX_EVENT_LOCATION_UPDATE, &event);
 }
 
 int UBlox::nextSocket() {
@@ -660,10 +806,10 @@ int UBlox::open(int port) {
     }
 
     if(modem->set("+USOCR", "6") == MODEM_OK) {
-        if(sscanf(modem->lastResponse(), "+USOCR: %d", &socketnum) == 1) {
+        if(atscan(modem->lastResponse(), "+USOCR: ", socketnum) == 1) {
+            _reset(socketnum);
             sockets[socketnum].id = nextSocket();
             sockets[socketnum].type = SOCKET_TYPE_LISTEN;
-            sockets[socketnum].bytes_available = 0;
             modem->startSet("+USOLI");
             modem->appendSet(socketnum);
             modem->appendSet(",");
@@ -678,6 +824,110 @@ int UBlox::open(int port) {
     return 0;
 }
 
+int UBlox::openUDP(int port) {
+    if(!isConnected()) return -1;
+
+    int socketnum = -1;
+    modem->startSet("+USOCR");
+    modem->appendSet(17);
+    if(port) {
+        modem->appendSet(",");
+        modem->appendSet(port);
+    }
+    if(modem->completeSet() == MODEM_OK) {
+        if(atscan(modem->lastResponse(), "+USOCR: ", socketnum) == 1) {
+            _reset(socketnum);
+            sockets[socketnum].id = nextSocket();
+            sockets[socketnum].type = SOCKET_TYPE_UDP;
+            return sockets[socketnum].id;
+        }
+    }
+    return -1;
+}
+
+//a datagram is sent as a whole, at most MAX_WRITE_LEN bytes
+bool UBlox::sendTo(int socket, const char* host, int port, const uint8_t* content, int length) {
+    if(!isConnected()) return false;
+    if(length <= 0 || length > MAX_WRITE_LEN) return false;
+
+    int socketnum = mapSocket(socket);
+    if(socketnum == -1) return false;
+    if(sockets[socketnum].type != SOCKET_TYPE_UDP) return false;
+
+    modem->checkURC();
+
+    //+USOST=<socket>,"<ip>",<port>,<length>
+    modem->startSet("+USOST");
+    modem->appendSet(socketnum);
+    modem->appendSet(",\"");
+    modem->appendSet(host);
+    modem->appendSet("\",");
+    modem->appendSet(port);
+    modem->appendSet(",");
+    modem->appendSet(length);
+    if(modem->intermediateSet('@', 10000) != MODEM_OK) return false;
+
+    wait(50);
+    modem->dataWrite(content, length);
+    if(modem->waitSetComplete(10000) != MODEM_OK) return false;
+
+    int sock = 0;
+    int len = 0;
+    if(atscan(modem->lastResponse(), "+USOST: ", sock, len) != 2) return false;
+    return (sock == socketnum) && (len == length);
+}
+
+//host must hold 16 characters, either host or port may be NULL
+//returns the datagram length, 0 on timeout or -1 on error
+int UBlox::recvFrom(int socket, uint8_t *buffer, int numbytes, char* host, int *port, uint32_t timeout) {
+    if(!isReady()) return -1;
+    int socketnum = mapSocket(socket);
+    if(socketnum == -1) return -1;
+    ublox_socket &s = sockets[socketnum];
+    if(s.type != SOCKET_TYPE_UDP) return -1;
+
+    if(numbytes > MAX_READ_LEN)
+        numbytes = MAX_READ_LEN;
+
+    uint32_t startMillis = modem->msTick();
+    while(modem->msTick() - startMillis < timeout) {
+        modem->checkURC();
+        if(s.bytes_available <= 0) continue;
+
+        //+USORF: <socket>,"<ip>",<port>,<length>,"<binary data>"
+        modem->startSet("+USORF");
+        modem->appendSet(socketnum);
+        modem->appendSet(",");
+        modem->appendSet(numbytes);
+        if(modem->headerSet(10000, 3) != MODEM_OK) return -1;
+
+        char remote[16] = "";
+        int sock = -1;
+        int remoteport = 0;
+        int length = 0;
+        if(atscan(modem->lastResponse(), "+USORF: ", sock, ATString(remote, sizeof(remote)), remoteport, length) != 4) {
+            modem->waitSetComplete(1000);
+            return -1;
+        }
+        if(length > numbytes)
+            length = numbytes;
+        int got = modem->dataRead(buffer, length, 10000);
+        modem->waitSetComplete(1000);
+
+        s.bytes_available -= got;
+        if(got == 0 || s.bytes_available < 0) {
+            //the modem had less than we were told, it is drained
+            s.bytes_available = 0;
+        }
+        if(got > 0) {
+            if(host) strcpy(host, remote);
+            if(port) *port = remoteport;
+            return got;
+        }
+    }
+    return 0;
+}
+
 int UBlox::open(const char* host, const char* port) {
     return open(host, atoi(port));
 }
@@ -687,10 +937,10 @@ int UBlox::open(const char* host, int port) {
 
     int socketnum = -1;
     if(modem->set("+USOCR", "6") == MODEM_OK) {
-        if(sscanf(modem->lastResponse(), "+USOCR: %d", &socketnum) == 1) {
+        if(atscan(modem->lastResponse(), "+USOCR: ", socketnum) == 1) {
+            _reset(socketnum);
             sockets[socketnum].id = nextSocket();
             sockets[socketnum].type = SOCKET_TYPE_ACTIVE;
-            sockets[socketnum].bytes_available = 0;
             modem->startSet("+USOCO");
             modem->appendSet(socketnum);
             modem->appendSet(",\"");
@@ -708,36 +958,85 @@ int UBlox::open(const char* host, int port) {
 }
 
 void UBlox::flush(int socket) {
-    if(!isConnected()) return;
+    int socketnum = mapSocket(socket);
+    if(socketnum == -1) return;
+    _flush(socketnum);
+}
+
+//sends whatever is buffered for the socket and returns the buffer to the pool
+void UBlox::_flush(int socketnum) {
+    ublox_socket &s = sockets[socketnum];
+    if(s.tx_buffer == -1) return;
+    if(s.tx_count && s.type == SOCKET_TYPE_ACTIVE) {
+        _send(socketnum, tx_pool[s.tx_buffer], s.tx_count);
+    }
+    tx_pool_used[s.tx_buffer] = false;
+    s.tx_buffer = -1;
+    s.tx_count = 0;
+}
 
-    if(write_id != socket) return;
-    if(write_count == 0) return;
+//flushes at most one socket per poll, the one holding the oldest data
+void UBlox::flushAged() {
+    uint32_t now = modem->msTick();
+    int oldest = -1;
+    for(int i=0; i<UBLOX_SOCKET_COUNT; i++) {
+        if(sockets[i].tx_count && (now - sockets[i].tx_start >= UBLOX_SOCKET_WR_FLUSH_MS)) {
+            if(oldest == -1 || (int32_t)(sockets[i].tx_start - sockets[oldest].tx_start) < 0)
+                oldest = i;
+        }
+    }
+    if(oldest != -1)
+        _flush(oldest);
+}
 
-    int socketnum = mapSocket(socket);
-    if((socketnum == -1) || (sockets[socketnum].type != SOCKET_TYPE_ACTIVE)) {
-        write_id = 0;
-        write_count = 0;
-        return;
+//takes a free write buffer, flushing the socket with the oldest data if
+//the pool is exhausted
+bool UBlox::_acquireTx(int socketnum) {
+    int oldest = -1;
+    for(int pass=0; pass<2; pass++) {
+        for(int i=0; i<UBLOX_SOCKET_WR_BUFFERS; i++) {
+            if(!tx_pool_used[i]) {
+                tx_pool_used[i] = true;
+                sockets[socketnum].tx_buffer = i;
+                sockets[socketnum].tx_count = 0;
+                return true;
+            }
+        }
+        for(int i=0; i<UBLOX_SOCKET_COUNT; i++) {
+            if(sockets[i].tx_buffer == -1) continue;
+            if(oldest == -1 || (int32_t)(sockets[i].tx_start - sockets[oldest].tx_start) < 0)
+                oldest = i;
+        }
+        if(oldest == -1) break;
+        _flush(oldest);
     }
+    return false;
+}
+
+//a single +USOWR transaction
+bool UBlox::_send(int socketnum, const uint8_t *content, int length) {
+    if(!isConnected()) return false;
 
     modem->checkURC();
 
+    bool sent = false;
     modem->startSet("+USOWR");
     modem->appendSet(socketnum);
     modem->appendSet(",");
-    modem->appendSet(write_count);
+    modem->appendSet(length);
     if(modem->intermediateSet('@', 10000) == MODEM_OK) {
         wait(50);
-        for(int i=0; i<write_count; i++)
-            modem->dataWrite(write_buffer[i]);
+        modem->dataWrite(content, length);
 
         if(modem->waitSetComplete(10000) == MODEM_OK) {
             int len = 0;
             int sock = 0;
-            if(sscanf(modem->lastResponse(), "+USOWR: %d,%d", &sock, &len) == 2) {
-                if((socketnum != sock) || (len != write_count)) {
+            if(atscan(modem->lastResponse(), "+USOWR: ", sock, len) == 2) {
+                if((socketnum != sock) || (len != length)) {
                     debug("ERROR Writing to socket ");
-                    debugln(socket);
+                    debugln(sockets[socketnum].id);
+                } else {
+                    sent = true;
                 }
             } else {
                 debug("ERROR lastResponse unexpected: ");
@@ -747,30 +1046,36 @@ void UBlox::flush(int socket) {
     } else {
         debugln("ERROR could not write to socket!");
     }
-    write_count = 0;
+    return sent;
 }
 
-//loop and write at-most UBLOX_SOCKET_WR_BUFFER_SIZE bytes at a time
-//have a local write buffer
-//once full, or read or close is called, flush
+//writes are coalesced in a per-socket buffer from tx_pool
+//flushed when full, when aged past UBLOX_SOCKET_WR_FLUSH_MS, or on read/close
+//anything at least a buffer long with nothing pending goes out uncopied
 bool UBlox::write(int socket, const uint8_t* content, int length) {
     if(!isConnected()) return false;
 
-    if(socket != write_id) flush(write_id);
-
     int socketnum = mapSocket(socket);
     if(socketnum == -1) return false;
-    if(sockets[socketnum].type != SOCKET_TYPE_ACTIVE) return false;
-
-    write_id = socket;
+    ublox_socket &s = sockets[socketnum];
+    if(s.type != SOCKET_TYPE_ACTIVE) return false;
 
     while(length) {
-        int topush = UBLOX_SOCKET_WR_BUFFER_SIZE - write_count;
+        if(s.tx_count == 0 && length >= UBLOX_SOCKET_WR_BUFFER_SIZE) {
+            int chunk = length < MAX_WRITE_LEN ? length : MAX_WRITE_LEN;
+            if(!_send(socketnum, content, chunk)) return false;
+            content += chunk;
+            length -= chunk;
+            continue;
+        }
+        if(s.tx_buffer == -1 && !_acquireTx(socketnum)) return false;
+        if(s.tx_count == 0) s.tx_start = modem->msTick();
+        int topush = UBLOX_SOCKET_WR_BUFFER_SIZE - s.tx_count;
         if(length < topush) topush = length;
-        memcpy(&(write_buffer[write_count]), content, topush);
-        write_count += topush;
-        if(write_count == UBLOX_SOCKET_WR_BUFFER_SIZE) {
-            flush(socket);
+        memcpy(&(tx_pool[s.tx_buffer][s.tx_count]), content, topush);
+        s.tx_count += topush;
+        if(s.tx_count == UBLOX_SOCKET_WR_BUFFER_SIZE) {
+            _flush(socketnum);
         }
         content += topush;
         length -= topush;
@@ -779,14 +1084,6 @@ bool UBlox::write(int socket, const uint8_t* content, int length) {
     return true;
 }
 
-void UBlox::setHexMode(bool hex) {
-    modem->startSet("+UDCONF");
-    modem->appendSet(1);
-    modem->appendSet(",");
-    modem->appendSet(hex ? 1 : 0);
-    modem->completeSet();
-}
-
 int UBlox::_socketState(int socketnum) {
     if(!isReady()) return 0;
 
@@ -795,7 +1092,7 @@ int UBlox::_socketState(int socketnum) {
     modem->appendSet(",10");
     if(modem->completeSet() == MODEM_OK) {
         int socket, paramid, sockstate;
-        if(sscanf(modem->lastResponse(), "+USOCTL: %d,%d,%d", &socket, &paramid, &sockstate) == 3) {
+        if(atscan(modem->lastResponse(), "+USOCTL: ", socket, paramid, sockstate) == 3) {
             return sockstate;
         }
     }
@@ -811,7 +1108,7 @@ int UBlox::_available(int socketnum) {
     modem->appendSet(",0");
     if(modem->completeSet() == MODEM_OK) {
         int socket, avail;
-        if(sscanf(modem->lastResponse(), "+USORD: %d,%d", &socket, &avail) == 2) {
+        if(atscan(modem->lastResponse(), "+USORD: ", socket, avail) == 2) {
             sockets[socketnum].bytes_available = avail;
             return avail;
         }
@@ -819,6 +1116,130 @@ int UBlox::_available(int socketnum) {
     return -1;
 }
 
+//expands count bytes at p in place to ascii hex, p must hold count*2
+static void expandHex(uint8_t* p, int count) {
+    static const char digits[] = "0123456789ABCDEF";
+    uint8_t* src = &p[count];
+    memmove(src, p, count);
+    for(int i=0; i<count; i++) {
+        uint8_t b = src[i];
+        p[i*2] = digits[b >> 4];
+        p[i*2+1] = digits[b & 0x0F];
+    }
+}
+
+//one +USORD straight into buffer, returns the number of bytes read
+int UBlox::_fetch(int socketnum, uint8_t *buffer, int length) {
+    if(length > MAX_READ_LEN)
+        length = MAX_READ_LEN;
+
+    //+USORD: <socket>,<length>,"<binary data>"
+    modem->startSet("+USORD");
+    modem->appendSet(socketnum);
+    modem->appendSet(",");
+    modem->appendSet(length);
+    if(modem->headerSet(10000) != MODEM_OK) return -1;
+
+    int socket = -1;
+    int actual_read = 0;
+    if(atscan(modem->lastResponse(), "+USORD: ", socket, actual_read) != 2) {
+        //the payload is unknown, let the final result carry it away
+        modem->waitSetComplete(1000);
+        return -1;
+    }
+    if(actual_read > length)
+        actual_read = length;
+    int got = modem->dataRead(buffer, actual_read, 10000);
+    modem->waitSetComplete(1000);
+
+    if(got < length) {
+        //the modem had less than we were told, it is drained
+        sockets[socketnum].bytes_available = 0;
+    } else {
+        sockets[socketnum].bytes_available -= got;
+    }
+    return got;
+}
+
+//move pending modem data into the socket's receive buffer
+//once stops after a single +USORD
+void UBlox::_fill(int socketnum, bool once) {
+    ublox_socket &s = sockets[socketnum];
+    if(s.type != SOCKET_TYPE_ACTIVE) return;
+
+    if(s.rx_buffer == -1 && s.bytes_available > 0) {
+        for(int i=0; i<UBLOX_SOCKET_RX_BUFFERS; i++) {
+            if(!rx_pool_used[i]) {
+                rx_pool_used[i] = true;
+                s.rx_buffer = i;
+                s.rx_head = 0;
+                s.rx_count = 0;
+                break;
+            }
+        }
+    }
+    if(s.rx_buffer == -1) return;
+
+    while(s.bytes_available > 0 && s.rx_count < UBLOX_SOCKET_RX_BUFFER_SIZE) {
+        int tail = (s.rx_head + s.rx_count) % UBLOX_SOCKET_RX_BUFFER_SIZE;
+        //contiguous free space after tail
+        int space = (tail >= s.rx_head) ? UBLOX_SOCKET_RX_BUFFER_SIZE - tail : s.rx_head - tail;
+        if(space > s.bytes_available)
+            space = s.bytes_available;
+        int got = _fetch(socketnum, &rx_pool[s.rx_buffer][tail], space);
+        if(got <= 0) break;
+        s.rx_count += got;
+        if(once) break;
+    }
+    if(s.rx_count == 0) {
+        //the fetch failed, don't sit on an empty buffer
+        _releaseRx(socketnum);
+    }
+}
+
+int UBlox::_drain(int socketnum, uint8_t *buffer, int length) {
+    ublox_socket &s = sockets[socketnum];
+    int copied = 0;
+    while(copied < length && s.rx_count) {
+        int count = UBLOX_SOCKET_RX_BUFFER_SIZE - s.rx_head;
+        if(count > s.rx_count) count = s.rx_count;
+        if(count > length - copied) count = length - copied;
+        memcpy(&buffer[copied], &rx_pool[s.rx_buffer][s.rx_head], count);
+        s.rx_head = (s.rx_head + count) % UBLOX_SOCKET_RX_BUFFER_SIZE;
+        s.rx_count -= count;
+        copied += count;
+    }
+    if(s.rx_count == 0) {
+        _releaseRx(socketnum);
+    }
+    return copied;
+}
+
+//hands the socket's receive buffer back to the pool
+void UBlox::_releaseRx(int socketnum) {
+    ublox_socket &s = sockets[socketnum];
+    if(s.rx_buffer != -1) {
+        rx_pool_used[s.rx_buffer] = false;
+        s.rx_buffer = -1;
+        s.rx_head = 0;
+    }
+}
+
+//called from pollEvents, pulls in data announced by +UUSORD
+void UBlox::prefetch() {
+    //one block for one socket per poll, the sockets taking turns. Only
+    //sockets the application reads are worth a receive buffer.
+    for(int n=0; n<UBLOX_SOCKET_COUNT; n++) {
+        int i = prefetch_next;
+        prefetch_next = (prefetch_next + 1) % UBLOX_SOCKET_COUNT;
+        ublox_socket &s = sockets[i];
+        if(s.reading && s.bytes_available > 0 && s.rx_count < UBLOX_SOCKET_RX_BUFFER_SIZE) {
+            _fill(i, true);
+            return;
+        }
+    }
+}
+
 //if hex mode, buffer must be numbytes*2
 int UBlox::read(int socket, int numbytes, uint8_t *buffer, uint32_t timeout, bool hex) {
     if(!isReady()) return -1;
@@ -827,52 +1248,33 @@ int UBlox::read(int socket, int numbytes, uint8_t *buffer, uint32_t timeout, boo
     if(socketnum == -1) return -1;
     if(sockets[socketnum].type != SOCKET_TYPE_ACTIVE) return -1;
 
-    if(write_id == socket) flush(write_id);
+    _flush(socketnum);
 
+    ublox_socket &s = sockets[socketnum];
+    s.reading = true;
     int numread = 0;
-    int numremain = numbytes;
 
     uint32_t startMillis = modem->msTick();
     do {
         modem->checkURC();
-        if(sockets[socketnum].bytes_available) {
-            int toread = sockets[socketnum].bytes_available;
-            if(toread > numremain)
-                toread = numremain;
-            if(toread > MAX_READ_LEN/2)
-                toread = MAX_READ_LEN/2;
-
-            setHexMode(true);
-
-            modem->startSet("+USORD");
-            modem->appendSet(socketnum);
-            modem->appendSet(",");
-            modem->appendSet(toread);
-            if(modem->completeSet() == MODEM_OK) {
-                int socket, actual_read;
-                if(sscanf(modem->lastResponse(), "+USORD: %d,%d,", &socket, &actual_read) == 2) {
-                    const char* q = strchr(modem->lastResponse(), '"');
-                    debug("READ: ");
-                    debugln(q);
-                    if(hex) {
-                        memcpy(&buffer[numread*2], &q[1], actual_read*2);
-                        numread += actual_read;
-                    } else {
-                        for(int i=0; i<actual_read; i++) {
-                            buffer[numread++] = Modem::convertHex(&q[1+i*2]);
-                        }
-                    }
-                    //sockets[socketnum].bytes_available -= actual_read;
-                    sockets[socketnum].bytes_available = 0;
-                    //numremain -= actual_read;
-                    numremain = 0;
-                }
-            }
-            setHexMode(false);
+        _fill(socketnum);
+        uint8_t* dst = hex ? &buffer[numread*2] : &buffer[numread];
+        int got = 0;
+        if(s.rx_count) {
+            got = _drain(socketnum, dst, numbytes - numread);
+        } else if(s.rx_buffer == -1 && s.bytes_available > 0) {
+            //no receive buffer to spare, read directly
+            got = _fetch(socketnum, dst, numbytes - numread);
         }
-    }while(sockets[socketnum].type == SOCKET_TYPE_ACTIVE && numremain && (modem->msTick() - startMillis < timeout));
+        if(got > 0) {
+            if(hex) expandHex(dst, got);
+            numread += got;
+        }
+        //once data has arrived only keep going while more is pending
+        if(numread && s.rx_count == 0 && s.bytes_available <= 0) break;
+    }while(s.type == SOCKET_TYPE_ACTIVE && numread < numbytes && (modem->msTick() - startMillis < timeout));
 
-    if(numread == 0 && sockets[socketnum].type != SOCKET_TYPE_ACTIVE)
+    if(numread == 0 && s.type != SOCKET_TYPE_ACTIVE)
         return -1;
     return numread;
 }
@@ -885,18 +1287,95 @@ bool UBlox::_close(int socketnum) {
         modem->completeSet(10000);
     }
 
-    sockets[socketnum].id = 0;
-    sockets[socketnum].type = SOCKET_TYPE_NONE;
-    sockets[socketnum].bytes_available = 0;
+    _reset(socketnum);
     return true;
 }
 
+void UBlox::_reset(int socketnum) {
+    ublox_socket &s = sockets[socketnum];
+    if(s.rx_buffer != -1) {
+        rx_pool_used[s.rx_buffer] = false;
+    }
+    if(s.tx_buffer != -1) {
+        tx_pool_used[s.tx_buffer] = false;
+    }
+    s.id = 0;
+    s.type = SOCKET_TYPE_NONE;
+    s.bytes_available = 0;
+    s.rx_buffer = -1;
+    s.rx_head = 0;
+    s.rx_count = 0;
+    s.tx_buffer = -1;
+    s.tx_count = 0;
+    s.reading = false;
+}
+
+bool UBlox::isOpen(int socket) {
+    if(socket <= 0) return false;
+    int socketnum = mapSocket(socket);
+    return (socketnum != -1) && (sockets[socketnum].type != SOCKET_TYPE_NONE);
+}
+
 bool UBlox::close(int socket) {
     int socketnum = mapSocket(socket);
     if(socketnum == -1) return true;
+    _flush(socketnum);
     _close(socketnum);
 }
 
+//+USODL switches the uart over to the socket's data stream
+bool UBlox::directLink(int socket) {
+    if(!isConnected() || direct_socket != -1) return false;
+    int socketnum = mapSocket(socket);
+    if(socketnum == -1) return false;
+    if(sockets[socketnum].type != SOCKET_TYPE_ACTIVE) return false;
+
+    _flush(socketnum);
+    modem->startSet("+USODL");
+    modem->appendSet(socketnum);
+    if(modem->connectSet(10000) != MODEM_OK) return false;
+    direct_socket = socketnum;
+    return true;
+}
+
+bool UBlox::exitDirectLink() {
+    if(direct_socket == -1) return true;
+    //unread payload is dropped, along with a DISCONNECT already waiting
+    uint8_t discard[32];
+    while(modem->linkRead(discard, sizeof(discard)) > 0);
+    if(_linkClosed()) return true;
+
+    wait(UBLOX_DL_GUARD_MS);
+    modem->rawWrite("+++");
+    wait(UBLOX_DL_GUARD_MS);
+    modem_result r = modem->disconnect(5000);
+    direct_socket = -1;
+    return r == MODEM_OK;
+}
+
+int UBlox::directWrite(const uint8_t* content, int length) {
+    if(direct_socket == -1 || _linkClosed()) return -1;
+    modem->dataWrite(content, length);
+    return length;
+}
+
+//returns whatever has arrived, without waiting
+int UBlox::directRead(uint8_t* buffer, int length) {
+    if(direct_socket == -1) return -1;
+    int count = modem->linkRead(buffer, length);
+    _linkClosed();
+    return count;
+}
+
+//the modem drops out of direct link by itself with DISCONNECT when the
+//remote side closes, which also closes the socket
+bool UBlox::_linkClosed() {
+    if(modem->suspended()) return false;
+    _reset(direct_socket);
+    direct_socket = -1;
+    return true;
+}
+
 bool UBlox::uhttp(int profile, int opcode, const char* value) {
     if(!isReady()) return false;
     modem->startSet("+UHTTP");
@@ -961,72 +1440,85 @@ int UBlox::filesize(const char *filename) {
     modem->appendSet(filename);
     modem->appendSet('"');
     if(modem->completeSet(1000) == MODEM_OK) {
-        if(sscanf(modem->lastResponse(), "+ULSTFILE: %d", &filesize) == 1) {
+        if(atscan(modem->lastResponse(), "+ULSTFILE: ", filesize) == 1) {
             return filesize;
         }
     }
     return -1;
 }
 
+//+UDWNFILE appends when the file already exists
+bool UBlox::appendFile(const char* filename, const uint8_t* content, int length) {
+    if(!isReady()) return false;
+    modem->startSet("+UDWNFILE");
+    modem->appendSet('"');
+    modem->appendSet(filename);
+    modem->appendSet("\",");
+    modem->appendSet(length);
+    if(modem->intermediateSet('>', 5000) != MODEM_OK) return false;
+    modem->dataWrite(content, length);
+    return modem->waitSetComplete(10000) == MODEM_OK;
+}
+
+bool UBlox::deleteFile(const char* filename) {
+    if(!isReady()) return false;
+    modem->startSet("+UDELFILE");
+    modem->appendSet('"');
+    modem->appendSet(filename);
+    modem->appendSet('"');
+    return modem->completeSet(5000) == MODEM_OK;
+}
+
 int UBlox::readFile(const char* filename, int offset, void* buffer, int size) {
-    //AT+URDBLOCK="<filename>",<offset>,<size>
-    //only read at-most 32 bytes at a time from ublox
-    if(!isReady()) return 0;
     if(offset < 0) return 0;
     int totalread = 0;
-    int filenamelen = strlen(filename);
-    char *pbuffer = (char*)buffer;
-    char scratch[filenamelen < 12 ? 12 : filenamelen+1];
+    uint8_t *pbuffer = (uint8_t*)buffer;
 
     while(size) {
         int toread = size;
-        if(toread > 32) toread = 32;
-
-        modem->startSet("+URDBLOCK");
-        modem->appendSet('"');
-        modem->appendSet(filename);
-        modem->appendSet("\",");
-        modem->appendSet(offset+totalread);
-        modem->appendSet(',');
-        modem->appendSet(toread);
-        if(modem->intermediateSet('+', 10000) == MODEM_OK) {
-            //+URDBLOCK: "<filename>",<numread>,"<content>"
-            modem->rawRead(11, scratch);
-            if(strcmp(scratch, "URDBLOCK: \"") != 0) break;
-
-            modem->rawRead(filenamelen, scratch);
-            if(strcmp(scratch, filename) != 0) break;
-
-            modem->rawRead(2, scratch);
-            if(strcmp(scratch, "\",") != 0) break;
-
-            modem->rawRead(2, scratch);
-            int numread = 0;
-            if(scratch[0] < '0' || scratch[0] > '9') break;
-            numread = scratch[0] - '0';
-            if(scratch[1] != ',') {
-                if(scratch[1] < '0' || scratch[1] > '9') break;
-                numread *= 10;
-                numread += scratch[1] - '0';
-                modem->rawRead(1, scratch);
-                if(scratch[0] != ',') break;
-            }
+        if(toread > UBLOX_FILE_BLOCK_SIZE) toread = UBLOX_FILE_BLOCK_SIZE;
+        if(!requestFile(filename, offset+totalread, toread)) break;
+        int got = receiveFile(pbuffer, toread);
+        if(got < 0) break;
+
+        pbuffer += got;
+        size -= got;
+        totalread += got;
+        if(got < toread) break;
+    }
+    return totalread;
+}
+
+//sends the +URDBLOCK without waiting, the response arrives in the uart
+//ring while the caller works and must be collected with receiveFile()
+bool UBlox::requestFile(const char* filename, int offset, int size) {
+    //AT+URDBLOCK="<filename>",<offset>,<size>
+    if(!isReady()) return false;
+    if(size > UBLOX_FILE_BLOCK_SIZE) return false;
+    modem->startSet("+URDBLOCK");
+    modem->appendSet('"');
+    modem->appendSet(filename);
+    modem->appendSet("\",");
+    modem->appendSet(offset);
+    modem->appendSet(',');
+    modem->appendSet(size);
+    return modem->sendSet() == MODEM_OK;
+}
 
-            modem->rawRead(1, scratch);
-            if(scratch[0] != '"') break;
-            modem->rawRead(numread, pbuffer);
-            modem->rawRead(1, scratch);
-            if(scratch[0] != '"') break;
+int UBlox::receiveFile(void* buffer, int size) {
+    //+URDBLOCK: "<filename>",<size>,"<data>"
+    if(modem->waitHeader(10000, 3) != MODEM_OK) return -1;
 
-            pbuffer += numread;
-            size -= numread;
-            totalread += numread;
-            if(numread < toread) break;
-        } else {
-            break;
-        }
+    int numread = 0;
+    if(atscan(modem->lastResponse(), "+URDBLOCK: ", ATSkip(), numread) != 2) {
+        modem->waitSetComplete(1000);
+        return -1;
     }
-    return totalread;
+    if(numread > size)
+        numread = size;
+    int got = modem->dataRead(buffer, numread, 10000);
+    modem->waitSetComplete(1000);
+    return got;
 }
 
 int UBlox::readFileLine(const char* filename, int offset, char* buffer, int size) {
@@ -32,6 +32,42 @@
 #define UBLOX_SOCKET_WR_BUFFER_SIZE 1024
 #endif
 
+//RAM shared by the socket write buffers
+#ifndef UBLOX_SOCKET_WR_BUDGET
+#define UBLOX_SOCKET_WR_BUDGET 2048
+#endif
+
+//buffered writes older than this are flushed from pollEvents
+#ifndef UBLOX_SOCKET_WR_FLUSH_MS
+#define UBLOX_SOCKET_WR_FLUSH_MS 100
+#endif
+
+#define UBLOX_SOCKET_WR_BUFFERS (UBLOX_SOCKET_WR_BUDGET/UBLOX_SOCKET_WR_BUFFER_SIZE)
+
+#ifndef UBLOX_SOCKET_RX_BUFFER_SIZE
+#define UBLOX_SOCKET_RX_BUFFER_SIZE 256
+#endif
+
+//RAM shared by the socket receive buffers, sockets without one read directly
+#ifndef UBLOX_SOCKET_RX_BUDGET
+#define UBLOX_SOCKET_RX_BUDGET 1024
+#endif
+
+#define UBLOX_SOCKET_RX_BUFFERS (UBLOX_SOCKET_RX_BUDGET/UBLOX_SOCKET_RX_BUFFER_SIZE)
+
+//silence required either side of the +++ escape (S12 default is 1s)
+#ifndef UBLOX_DL_GUARD_MS
+#define UBLOX_DL_GUARD_MS 1200
+#endif
+
+//largest +URDBLOCK read. The header is taken as soon as it arrives and the
+//data is drained from the uart ring as it streams in, so a block may be
+//larger than the ring. A request left waiting in the ring (UBloxStream) has
+//to fit there whole, header included.
+#ifndef UBLOX_FILE_BLOCK_SIZE
+#define UBLOX_FILE_BLOCK_SIZE 512
+#endif
+
 #define UBLOX_MODEL_SIZE 16
 
 typedef struct {
@@ -114,6 +150,7 @@ typedef enum {
     SOCKET_TYPE_NONE,
     SOCKET_TYPE_LISTEN,
     SOCKET_TYPE_ACTIVE,
+    SOCKET_TYPE_UDP,
 }socket_type;
 
 class UBlox : public Network, public URCReceiver {
@@ -154,6 +191,18 @@ public:
     int read(int socket, int numbytes, uint8_t *buffer, uint32_t timeout) {return read(socket, numbytes, buffer, timeout, false);}
     int read(int socket, int numbytes, uint8_t *buffer, uint32_t timeout, bool hex);
     bool close(int socket);
+    bool isOpen(int socket);
+
+    int openUDP(int port=0);
+    bool sendTo(int socket, const char* host, int port, const uint8_t* content, int length);
+    int recvFrom(int socket, uint8_t *buffer, int numbytes, char* host, int *port, uint32_t timeout=10000);
+
+    //Direct link, the uart carries the socket's raw data until exited
+    bool directLink(int socket);
+    bool exitDirectLink();
+    bool isDirectLink() {return direct_socket != -1;}
+    int directWrite(const uint8_t* content, int length);
+    int directRead(uint8_t* buffer, int length);
 
     int getIMSI(char *id);
     int getICCID(char *id);
@@ -163,7 +212,11 @@ public:
 
     //UBlox File System
     int filesize(const char *filename);
+    bool appendFile(const char* filename, const uint8_t* content, int length);
+    bool deleteFile(const char* filename);
     int readFile(const char* filename, int offset, void* buffer, int size);
+    bool requestFile(const char* filename, int offset, int size);
+    int receiveFile(void* buffer, int size);
     int readFileLine(const char* filename, int offset, char* buffer, int size);
 
     const char* query(const char* cmd, uint32_t timeout=500, uint32_t retries=0);
@@ -177,10 +230,35 @@ public:
 protected:
     typedef struct {
         int id;
-        int bytes_available;
+        int bytes_available;  //still on the modem
         socket_type type;
+        int rx_buffer;        //index into rx_pool, -1 when not holding one
+        uint16_t rx_head;
+        uint16_t rx_count;
+        int tx_buffer;        //index into tx_pool, -1 when not holding one
+        uint16_t tx_count;
+        uint32_t tx_start;    //msTick of the oldest buffered byte
+        bool reading;         //read() has been called, so pollEvents prefetches
     }ublox_socket;
 
+    typedef void (UBlox::*urc_handler)(const URCArgs &args);
+
+    typedef struct {
+        uint32_t key;       //urcKey(prefix)
+        const char* prefix;
+        urc_handler handler;
+    }urc_route;
+
+    static const urc_route urc_routes[];
+
+    typedef struct {
+        const char* cmd;
+        const char* value;
+        uint32_t timeout;
+    }sim_setting;
+
+    static const sim_setting sim_settings[];
+
     virtual void wait(uint32_t ms)=0;
     virtual void holdReset()=0;
     virtual void releaseReset()=0;
@@ -196,6 +274,14 @@ protected:
     void state_unregistered();
     void state_registered();
 
+    void queueRefresh();
+
+    static void onSimConfigured(modem_result result, const char* response, void* context);
+    static void onSocketState(modem_result result, const char* response, void* context);
+    static void onSocketAvailable(modem_result result, const char* response, void* context);
+    static void onSMSCount(modem_result result, const char* response, void* context);
+    static void onConnectComplete(modem_result result, const char* response, void* context);
+
     bool checkRegistered();
     void setRegistered(bool reg);
     bool initModem(int delay_seconds=1);
@@ -203,19 +289,39 @@ protected:
 
     void loadModel();
 
-    void setHexMode(bool hex);
-
     int nextSocket();
     int mapSocket(int socket);
     int _socketState(int socketnum);
     int _available(int socketnum);
     bool _close(int socketnum);
+    void _reset(int socketnum);
+    int _fetch(int socketnum, uint8_t *buffer, int length);
+    void _fill(int socketnum, bool once=false);
+    int _drain(int socketnum, uint8_t *buffer, int length);
+    void _releaseRx(int socketnum);
+    bool _linkClosed();
+    void prefetch();
+    bool _acquireTx(int socketnum);
+    void _flush(int socketnum);
+    bool _send(int socketnum, const uint8_t *content, int length);
+    void flushAged();
 
     void rev_octet(char*& dst, const char* src);
     char gsm7toascii(char c, bool esc);
     void convert7to8bit(char* dst, const char* src, int num_chars);
     bool parse_sms_pdu(const char* fullpdu, sms_event &parsed_sms);
 
+    void urcSocketRead(const URCArgs &args);
+    void urcDatagramRead(const URCArgs &args);
+    void urcSocketClosed(const URCArgs &args);
+    void urcSocketAccept(const URCArgs &args);
+    void urcSMSReceived(const URCArgs &args);
+    void urcPacketDisconnect(const URCArgs &args);
+    void urcRegistration(const URCArgs &args);
+    void urcHttpResult(const URCArgs &args);
+    void urcTimeZone(const URCArgs &args);
+    void urcLocation(const URCArgs &args);
+
     bool uhttp(int profile, int opcode, const char* value);
     bool uhttp(int profile, int opcode, int value);
 
@@ -227,11 +333,16 @@ protected:
     sms_event sms;
 
     ublox_socket sockets[UBLOX_SOCKET_COUNT];
-    uint8_t write_buffer[UBLOX_SOCKET_WR_BUFFER_SIZE];
-    int write_count;
-    uint32_t write_id;
+    uint8_t rx_pool[UBLOX_SOCKET_RX_BUFFERS][UBLOX_SOCKET_RX_BUFFER_SIZE];
+    bool rx_pool_used[UBLOX_SOCKET_RX_BUFFERS];
+    uint8_t tx_pool[UBLOX_SOCKET_WR_BUFFERS][UBLOX_SOCKET_WR_BUFFER_SIZE];
+    bool tx_pool_used[UBLOX_SOCKET_WR_BUFFERS];
 
     int socket_id;
+    int direct_socket; //socketnum in direct link mode, -1 when none
+    int prefetch_next; //socketnum prefetch looks at first
+    int config_next;   //next sim_settings entry to queue
+    int refresh_next;  //next socket state to queue after SIM setup, -1 when done
     int httpGetFlag;
 
     uint16_t num_sms;
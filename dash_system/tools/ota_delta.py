@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""
+ota_delta.py - Builds and applies delta patches for user module OTA updates
+
+https://hologram.io
+
+Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+A patch is applied in place by Updater::patchUserModule. Sectors are rebuilt
+in order, so a sector may only copy from its own old content (which the
+device stages in the MCU flash reserved as UPDATER_SCRATCH first) or from
+sectors after it. --no-staging builds a patch for firmware without one.
+
+    ota_delta.py diff old.bin new.bin patch.bin --sector-size 4096 [--no-staging]
+    ota_delta.py apply old.bin patch.bin new.bin
+
+diff applies the patch it wrote the same way the device does and fails if
+the result does not match new.bin.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x32504448  # HDP2
+HEADER = struct.Struct('<10I')
+
+KEEP, BUILD, STAGED = b'K', b'B', b'S'
+COPY, ADD, END = b'C', b'A', b'E'
+
+MIN_MATCH = 12      # a copy costs 7 bytes
+MAX_COUNT = 0xFFFF
+KEY = 8
+MAX_CANDIDATES = 32
+
+
+class PatchError(Exception):
+    pass
+
+
+def sector_of(image, sector, size):
+    data = image[sector*size:(sector+1)*size]
+    return data + b'\xFF'*(size - len(data))
+
+
+def index_old(old):
+    index = {}
+    for pos in range(0, len(old) - KEY + 1):
+        index.setdefault(old[pos:pos+KEY], []).append(pos)
+    return index
+
+
+def longest_match(old, new, pos, end, lowest, index):
+    best_from, best_len = 0, 0
+    limit = min(end - pos, MAX_COUNT)
+    # the same offset is the most likely match when code has not moved
+    candidates = [pos] if pos >= lowest else []
+    candidates += index.get(new[pos:pos+KEY], [])[-MAX_CANDIDATES:]
+    for start in candidates:
+        if start < lowest:
+            continue
+        length = 0
+        while length < limit and start + length < len(old) and old[start+length] == new[pos+length]:
+            length += 1
+        if length > best_len:
+            best_from, best_len = start, length
+    return best_from, best_len
+
+
+def diff(old, new, size, base, staging=True):
+    out = bytearray()
+    any_staged = False
+    index = index_old(old)
+    sectors = (len(new) + size - 1) // size
+    for sector in range(sectors):
+        start = sector*size
+        end = min(start + size, len(new))
+        if sector_of(new, sector, size) == sector_of(old, sector, size):
+            out += KEEP
+            continue
+
+        # without staging a sector cannot copy from itself
+        lowest = start if staging else start + size
+        ops = bytearray()
+        staged = False
+        literal = bytearray()
+
+        def flush_literal():
+            while literal:
+                chunk = literal[:MAX_COUNT]
+                ops.extend(ADD + struct.pack('<H', len(chunk)) + chunk)
+                del literal[:MAX_COUNT]
+
+        pos = start
+        while pos < end:
+            source, length = longest_match(old, new, pos, end, lowest, index)
+            if length >= MIN_MATCH:
+                flush_literal()
+                ops.extend(COPY + struct.pack('<IH', source, length))
+                if source < start + size:
+                    staged = True
+                pos += length
+            else:
+                literal.append(new[pos])
+                pos += 1
+        flush_literal()
+        any_staged = any_staged or staged
+        out += (STAGED if staged else BUILD) + ops + END
+    # the body crc lets the device check the whole download before erasing
+    header = HEADER.pack(MAGIC, size, base, len(old), len(new), int(any_staged),
+                         zlib.crc32(old) & 0xFFFFFFFF, zlib.crc32(new) & 0xFFFFFFFF,
+                         len(out), zlib.crc32(bytes(out)) & 0xFFFFFFFF)
+    return header + bytes(out)
+
+
+class Reader(object):
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, count):
+        if self.pos + count > len(self.data):
+            raise PatchError('patch is truncated')
+        chunk = self.data[self.pos:self.pos+count]
+        self.pos += count
+        return chunk
+
+
+def apply(old, patch):
+    """Applies a patch the way Updater::patchUserModule does, in place."""
+    reader = Reader(patch)
+    (magic, size, base, old_size, new_size, staging, old_crc, new_crc,
+     body_size, body_crc) = HEADER.unpack(reader.take(HEADER.size))
+    if magic != MAGIC:
+        raise PatchError('not a delta patch')
+    body = patch[HEADER.size:]
+    if body_size != len(body) or body_crc != zlib.crc32(body) & 0xFFFFFFFF:
+        raise PatchError('patch body fails its crc')
+    if old_size != len(old) or old_crc != zlib.crc32(old) & 0xFFFFFFFF:
+        raise PatchError('patch was made against a different image')
+
+    sectors = (new_size + size - 1) // size
+    flash = bytearray(sector_of(old, 0, size*max(sectors, (old_size + size - 1)//size)))
+    staged_copy = None
+    for sector in range(sectors):
+        start = sector*size
+        length = min(size, new_size - start)
+        op = reader.take(1)
+        if op == KEEP:
+            continue
+        if op == STAGED:
+            if not staging:
+                raise PatchError('sector %d is staged in an unstaged patch' % sector)
+            staged_copy = bytes(flash[start:start+size])
+        elif op != BUILD:
+            raise PatchError('bad sector op %r' % op)
+
+        flash[start:start+size] = b'\xFF'*size
+        built = bytearray()
+        while True:
+            cmd = reader.take(1)
+            if cmd == END:
+                break
+            if cmd == COPY:
+                source, count = struct.unpack('<IH', reader.take(6))
+                if source < start or source + count > old_size:
+                    raise PatchError('sector %d copies from a rewritten region' % sector)
+                for offset in range(source, source + count):
+                    if offset < start + size:
+                        if op != STAGED:
+                            raise PatchError('sector %d copies from itself unstaged' % sector)
+                        built.append(staged_copy[offset - start])
+                    else:
+                        built.append(flash[offset])
+            elif cmd == ADD:
+                count, = struct.unpack('<H', reader.take(2))
+                built += reader.take(count)
+            else:
+                raise PatchError('bad command %r' % cmd)
+            if len(built) > length:
+                raise PatchError('sector %d overflows' % sector)
+        if len(built) != length:
+            raise PatchError('sector %d is short' % sector)
+        flash[start:start+length] = built
+    if reader.pos != len(patch):
+        raise PatchError('trailing data after the last sector')
+    if zlib.crc32(bytes(flash[:new_size])) & 0xFFFFFFFF != new_crc:
+        raise PatchError('patched image fails its crc')
+    return bytes(flash[:new_size])
+
+
+def read_file(name):
+    with open(name, 'rb') as f:
+        return f.read()
+
+
+def write_file(name, data):
+    with open(name, 'wb') as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Delta patches for user module OTA updates')
+    sub = parser.add_subparsers(dest='command')
+
+    d = sub.add_parser('diff', help='build a patch from old.bin to new.bin')
+    d.add_argument('old')
+    d.add_argument('new')
+    d.add_argument('patch')
+    # the EZPort sector size the device firmware was built with (EZPORT in
+    # WVariant.cpp), a patch for any other size is rejected by the device
+    d.add_argument('--sector-size', type=lambda x: int(x, 0), required=True)
+    d.add_argument('--base', type=lambda x: int(x, 0), default=0x8000)
+    d.add_argument('--no-staging', dest='staging', action='store_false',
+                   help='for firmware built without UPDATER_SCRATCH')
+
+    a = sub.add_parser('apply', help='apply a patch to old.bin')
+    a.add_argument('old')
+    a.add_argument('patch')
+    a.add_argument('new')
+
+    args = parser.parse_args()
+    try:
+        if args.command == 'diff':
+            old, new = read_file(args.old), read_file(args.new)
+            patch = diff(old, new, args.sector_size, args.base, args.staging)
+            if apply(old, patch) != new:
+                raise PatchError('patch does not reproduce the new image')
+            write_file(args.patch, patch)
+            print('%d bytes, %d%% of the image' % (len(patch), 100*len(patch)//max(len(new), 1)))
+        elif args.command == 'apply':
+            write_file(args.new, apply(read_file(args.old), read_file(args.patch)))
+        else:
+            parser.print_help()
+            return 2
+    except PatchError as e:
+        sys.stderr.write('error: %s\n' % e)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
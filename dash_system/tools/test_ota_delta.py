@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+test_ota_delta.py - Tests for ota_delta.py
+
+https://hologram.io
+
+Copyright (c) 2017 Konekt, Inc.  All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+    python3 test_ota_delta.py
+"""
+import random
+import struct
+import unittest
+
+import ota_delta
+
+SECTOR = 4096
+BASE = 0x8000
+
+
+def image(seed, size):
+    rng = random.Random(seed)
+    return bytes(rng.getrandbits(8) for _ in range(size))
+
+
+class OtaDeltaTest(unittest.TestCase):
+    def setUp(self):
+        self.old = image(1, 5*SECTOR + 300)
+        new = bytearray(self.old)
+        new[SECTOR + 100:SECTOR + 120] = b'x'*20     # staged, copies from itself
+        new[3*SECTOR:3*SECTOR] = b'inserted'         # everything after moves
+        new += image(2, 700)
+        self.new = bytes(new)
+
+    def test_round_trip(self):
+        for staging in (True, False):
+            patch = ota_delta.diff(self.old, self.new, SECTOR, BASE, staging)
+            self.assertEqual(ota_delta.apply(self.old, patch), self.new)
+            self.assertLess(len(patch), len(self.new))
+
+    def test_round_trip_unchanged(self):
+        patch = ota_delta.diff(self.old, self.old, SECTOR, BASE)
+        self.assertEqual(ota_delta.apply(self.old, patch), self.old)
+
+    def test_corrupted_body_rejected(self):
+        patch = bytearray(ota_delta.diff(self.old, self.new, SECTOR, BASE))
+        patch[-3] ^= 0x01
+        with self.assertRaisesRegex(ota_delta.PatchError, 'body fails its crc'):
+            ota_delta.apply(self.old, bytes(patch))
+
+    def test_wrong_base_rejected(self):
+        patch = ota_delta.diff(self.old, self.new, SECTOR, BASE)
+        other = bytearray(self.old)
+        other[10] ^= 0x01
+        with self.assertRaisesRegex(ota_delta.PatchError, 'different image'):
+            ota_delta.apply(bytes(other), patch)
+
+    def test_wrong_base_crc_rejected(self):
+        patch = bytearray(ota_delta.diff(self.old, self.new, SECTOR, BASE))
+        fields = list(ota_delta.HEADER.unpack_from(patch))
+        fields[6] ^= 0x01
+        ota_delta.HEADER.pack_into(patch, 0, *fields)
+        with self.assertRaisesRegex(ota_delta.PatchError, 'different image'):
+            ota_delta.apply(self.old, bytes(patch))
+
+    def test_truncated_rejected(self):
+        patch = ota_delta.diff(self.old, self.new, SECTOR, BASE)
+        for length in (len(patch) - 1, ota_delta.HEADER.size + 5, ota_delta.HEADER.size - 1):
+            with self.assertRaises(ota_delta.PatchError):
+                ota_delta.apply(self.old, patch[:length])
+
+    def test_truncated_with_matching_crc_rejected(self):
+        # a body cut short but given a matching crc must still fail
+        patch = ota_delta.diff(self.old, self.new, SECTOR, BASE)
+        body = patch[ota_delta.HEADER.size:-1]
+        fields = list(ota_delta.HEADER.unpack_from(patch))
+        fields[8], fields[9] = len(body), ota_delta.zlib.crc32(body) & 0xFFFFFFFF
+        with self.assertRaisesRegex(ota_delta.PatchError, 'truncated'):
+            ota_delta.apply(self.old, ota_delta.HEADER.pack(*fields) + body)
+
+    def test_staged_sector_needs_staging(self):
+        patch = bytearray(ota_delta.diff(self.old, self.new, SECTOR, BASE))
+        fields = list(ota_delta.HEADER.unpack_from(patch))
+        self.assertEqual(fields[5], 1)
+        fields[5] = 0
+        ota_delta.HEADER.pack_into(patch, 0, *fields)
+        with self.assertRaisesRegex(ota_delta.PatchError, 'unstaged patch'):
+            ota_delta.apply(self.old, bytes(patch))
+
+
+if __name__ == '__main__':
+    unittest.main()